@@ -64,6 +64,7 @@ class Acpi_apic
             LAPIC   = 0,
             IOAPIC  = 1,
             INTR    = 2,
+            X2APIC  = 9,
         };
 };
 
@@ -78,6 +79,18 @@ class Acpi_lapic : public Acpi_apic
         uint32  flags;
 };
 
+/*
+ * Processor Local x2APIC (5.2.12.12)
+ */
+class Acpi_x2apic : public Acpi_apic
+{
+    public:
+        uint16  reserved;
+        uint32  apic_id;
+        uint32  flags;
+        uint32  acpi_id;
+};
+
 /*
  * I/O APIC (5.2.11.6)
  */
@@ -110,6 +123,10 @@ class Acpi_table_madt : public Acpi_table
     private:
         static void parse_lapic (Acpi_apic const *);
 
+        static void parse_x2apic (Acpi_apic const *);
+
+        static void add_cpu (uint32, uint32, uint32);
+
         static void parse_ioapic (Acpi_apic const *);
 
         void parse_entry (Acpi_apic::Type, void (*)(Acpi_apic const *)) const;
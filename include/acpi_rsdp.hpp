@@ -41,6 +41,9 @@ class Acpi_rsdp
 
         static Acpi_rsdp *find (mword, unsigned);
 
+        // Record the addresses of the system description tables.
+        void use() const;
+
     public:
         static void parse (mword = 0);
 };
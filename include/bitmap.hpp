@@ -204,6 +204,50 @@ class Bitmap
             Atomic::clr_mask (bitmap_[word_index(i)], bit_mask(i));
         }
 
+        /// Set count bits starting at bit i to the value v.
+        ///
+        /// Words that only hold bits of the range are written with plain
+        /// stores, so concurrent updates of the same range are not allowed.
+        /// The words at the edges of the range are updated atomically, so
+        /// bits outside of the range can be changed concurrently.
+        void atomic_set_range(size_t i, size_t count, bool v)
+        {
+            assert(i <= NUMBER_OF_BITS and count <= NUMBER_OF_BITS - i);
+
+            while (count > 0) {
+                size_t const bits {min(count, BITS_PER_WORD - bit_index(i))};
+                T      const ones {static_cast<T>(~static_cast<T>(0))};
+                T      const mask {bits == BITS_PER_WORD ? ones : static_cast<T>(((static_cast<T>(1) << bits) - 1) << bit_index(i))};
+                T            &word {bitmap_[word_index(i)]};
+
+                if (mask == ones) {
+                    word = v ? ones : 0;
+                } else if (v) {
+                    Atomic::set_mask (word, mask);
+                } else {
+                    Atomic::clr_mask (word, mask);
+                }
+
+                i     += bits;
+                count -= bits;
+            }
+        }
+
+        /// Return true, if no bit is set.
+        ///
+        /// Each word is loaded atomically, but concurrent updates of other
+        /// words may not be observed.
+        bool atomic_none() const
+        {
+            for (size_t i = 0; i < WORDS; i++) {
+                if (Atomic::load (bitmap_[i])) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
         /// Atomically merge two bitmaps.
         ///
         /// Note: This function is safe to be called concurrently, i.e. it is
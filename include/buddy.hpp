@@ -34,6 +34,7 @@ class Buddy
                 Block *         next;
                 unsigned short  ord;
                 unsigned short  tag;
+                unsigned        refs;   // Additional references to used blocks
 
                 enum {
                     Used  = 0,
@@ -95,8 +96,24 @@ class Buddy
 
         void *alloc (unsigned short ord, Fill fill_mem);
 
+        // Like alloc, but returns nullptr instead of panicking, if there is
+        // no free block of the given order.
+        void *try_alloc (unsigned short ord, Fill fill_mem);
+
         void free (mword addr);
 
+        // Blocks can be referenced from multiple places, e.g. page tables that
+        // are shared between page tables. A newly allocated block has a single
+        // reference. Blocks outside of the allocator are never shared.
+        void ref (mword addr);
+
+        // Drop a reference. Returns true, if this was the last reference and
+        // the caller has to free the block.
+        bool unref (mword addr);
+
+        // Returns true, if there is more than one reference to the block.
+        bool shared (mword addr);
+
         static inline void *phys_to_ptr (Paddr phys)
         {
             return reinterpret_cast<void *>(allocator.phys_to_virt (static_cast<mword>(phys)));
@@ -42,6 +42,7 @@ class Cmdline
         static inline bool serial;
         static inline bool nodl;
         static inline bool nopcid;
+        static inline bool nox2apic;
         static inline bool novga;
         static inline bool novpid;
 
@@ -29,6 +29,29 @@ class Counter
     public:
         CPULOCAL_ACCESSOR(counter, tlb_shootdown);
 
+        // The number of cache lines written back for non-coherent page tables.
+        CPULOCAL_REMOTE_ACCESSOR(counter, cache_flush);
+
+        // The number of remote TLB shootdowns this CPU initiated, the number
+        // of CPUs it interrupted for them and the TSC cycles it spent from
+        // sending the IPIs until all CPUs acknowledged them (in total and for
+        // the slowest shootdown).
+        CPULOCAL_REMOTE_ACCESSOR(counter, shootdowns);
+        CPULOCAL_REMOTE_ACCESSOR(counter, shootdown_ipis);
+        CPULOCAL_REMOTE_ACCESSOR(counter, shootdown_cycles);
+        CPULOCAL_REMOTE_ACCESSOR(counter, shootdown_max_cycles);
+
+        // The number of times this CPU invalidated stale host TLB entries by
+        // flushing the whole TLB or individual pages, and the number of
+        // INVEPTs it executed for stale guest TLB entries.
+        CPULOCAL_REMOTE_ACCESSOR(counter, tlb_flush_full);
+        CPULOCAL_REMOTE_ACCESSOR(counter, tlb_flush_ranged);
+        CPULOCAL_REMOTE_ACCESSOR(counter, invept);
+
+        // The number of scheduled TLB flushes that were discarded (see
+        // Tlb_cleanup::ignore_tlb_flush).
+        CPULOCAL_REMOTE_ACCESSOR(counter, tlb_flush_ignored);
+
         static inline unsigned remote_tlb_shootdown (unsigned cpu)
         {
             return Atomic::load (Cpulocal::get_remote (cpu).counter_tlb_shootdown);
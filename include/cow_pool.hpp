@@ -0,0 +1,108 @@
+/*
+ * Copy-on-write page pool
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "memory.hpp"
+#include "types.hpp"
+
+// The pages that a memory space may use for the copies of its copy-on-write
+// pages (see Space_mem::resolve_cow).
+//
+// Copies are allocated from the kernel by PAGE_ALLOC, so no other memory
+// space can access them. Memory donations only add to the number of copies
+// the pool may allocate. The copies stay allocated until the pool is
+// destroyed together with its memory space, because they may still be
+// mapped until then.
+template <typename PAGE_ALLOC>
+class Cow_pool
+{
+    private:
+        using pointer = typename PAGE_ALLOC::pointer;
+
+        // A page that records the physical addresses of copies.
+        struct Index
+        {
+            Index *next;
+            uint64 used;
+            uint64 phys[PAGE_SIZE / sizeof (uint64) - 2];
+        };
+
+        static_assert (sizeof (Index) == PAGE_SIZE, "Index pages must fill a page");
+
+        uint64 credit_ {0};
+        Index *copies_ {nullptr};
+
+    public:
+        Cow_pool() = default;
+
+        Cow_pool (Cow_pool const &) = delete;
+        Cow_pool &operator= (Cow_pool const &) = delete;
+
+        ~Cow_pool()
+        {
+            while (Index *const index {copies_}) {
+                for (uint64 i {0}; i < index->used; i++) {
+                    PAGE_ALLOC::free_page (PAGE_ALLOC::phys_to_pointer (index->phys[i]));
+                }
+
+                copies_ = index->next;
+                PAGE_ALLOC::free_page (reinterpret_cast<pointer>(index));
+            }
+        }
+
+        // Allow the given number of further copies.
+        void add(uint64 pages)
+        {
+            credit_ += pages;
+        }
+
+        // Allocate a page for a copy. Returns false, if the pool may not
+        // allocate any more copies or the kernel is out of memory.
+        bool take(uint64 &phys)
+        {
+            if (credit_ == 0) {
+                return false;
+            }
+
+            if (not copies_ or copies_->used == sizeof (copies_->phys) / sizeof (copies_->phys[0])) {
+                Index *const index {reinterpret_cast<Index *>(PAGE_ALLOC::try_alloc_zeroed_page())};
+
+                if (not index) {
+                    return false;
+                }
+
+                index->next = copies_;
+                copies_     = index;
+            }
+
+            pointer const page {PAGE_ALLOC::try_alloc_zeroed_page()};
+
+            if (not page) {
+                return false;
+            }
+
+            phys = PAGE_ALLOC::pointer_to_phys (page);
+            copies_->phys[copies_->used++] = phys;
+            credit_--;
+
+            return true;
+        }
+
+        // Returns the number of copies the pool may still allocate.
+        uint64 pages() const { return credit_; }
+};
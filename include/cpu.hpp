@@ -51,11 +51,14 @@ class Cpu
             FEAT_HTT            = 28,
             FEAT_VMX            = 37,
             FEAT_PCID           = 49,
+            FEAT_X2APIC         = 53,
             FEAT_TSC_DEADLINE   = 56,
             FEAT_XSAVE          = 58,
             FEAT_FSGSBASE       = 96,
             FEAT_SMEP           = 103,
             FEAT_SMAP           = 116,
+            FEAT_CLFLUSHOPT     = 119,
+            FEAT_CLWB           = 120,
             FEAT_1GB_PAGES      = 154,
             FEAT_CMP_LEGACY     = 161,
             FEAT_SVM            = 162,
@@ -155,7 +158,7 @@ class Cpu
 
         static unsigned online;
         static uint8    acpi_id[NUM_CPU];
-        static uint8    apic_id[NUM_CPU];
+        static uint32   apic_id[NUM_CPU];
 
         struct lapic_info_t {
             uint32 id, version, svr, reserved;
@@ -21,8 +21,10 @@
 #include "config.hpp"
 #include "compiler.hpp"
 #include "gdt.hpp"
+#include "pcid.hpp"
 #include "types.hpp"
 #include "rcu_list.hpp"
+#include "remap_slots.hpp"
 #include "rq.hpp"
 #include "vmx_types.hpp"
 
@@ -73,6 +75,9 @@ struct alignas(PAGE_SIZE) Per_cpu {
     // The current protection domain.
     Pd *pd_current;
 
+    // The PCIDs of the protection domains that ran here recently.
+    Pcid<Pd> pd_pcids;
+
     // The current scheduling context.
     Sc *sc_current;
 
@@ -120,6 +125,19 @@ struct alignas(PAGE_SIZE) Per_cpu {
 
     // Statistics
     uint32   counter_tlb_shootdown;
+    mword    counter_cache_flush;
+    mword    counter_shootdowns;
+    mword    counter_shootdown_ipis;
+    uint64   counter_shootdown_cycles;
+    uint64   counter_shootdown_max_cycles;
+    mword    counter_tlb_flush_full;
+    mword    counter_tlb_flush_ranged;
+    mword    counter_invept;
+    mword    counter_tlb_flush_ignored;
+
+    // The TLB shootdown counters of remote CPUs as sampled by the last
+    // shootdown this CPU initiated. This is too large for the kernel stack.
+    uint32   shootdown_ctr[NUM_CPU];
 
     // CPU-related variables (that are not performance critical)
     uint32   cpu_features[9];
@@ -136,6 +154,9 @@ struct alignas(PAGE_SIZE) Per_cpu {
     Rcu_list rcu_curr;
     Rcu_list rcu_done;
 
+    // The temporary mapping windows of this CPU (see Hpt::remap)
+    Remap_slots hpt_remap_slots;
+
     // Global descriptor table
     alignas(8) Gdt::Gdt_array gdt;
 };
@@ -149,8 +170,15 @@ class Cpulocal
 {
         static Per_cpu cpu[NUM_CPU];
 
+        // Set, once the BSP has set up its CPU-local memory. APs set up their
+        // CPU-local memory before they run any other code.
+        static bool ready;
+
     public:
 
+        // Returns true, if get() can be used.
+        static bool is_ready() { return ready; }
+
         static Per_cpu &get()
         {
             char *r;
@@ -160,7 +188,8 @@ class Cpulocal
 
         static Per_cpu &get_remote(unsigned cpu_id);
 
-        // Set up CPU local memory for the current CPU. Returns the stack pointer.
+        // Set up CPU local memory for the current CPU. Returns the stack pointer
+        // or 0, if the CPU is unknown.
         static mword setup_cpulocal() asm ("setup_cpulocal");
 
         template <typename T, size_t OFFSET>
@@ -21,6 +21,7 @@
 #pragma once
 
 #include "bitmap.hpp"
+#include "config.hpp"
 #include "types.hpp"
 
 class Cpuset
@@ -35,6 +36,8 @@ class Cpuset
 
         void clr (unsigned cpu) { bits[cpu].atomic_clear(); }
 
+        bool empty() const { return bits.atomic_none(); }
+
         /// Merge another Cpuset into this one. This effectively calculates the
         /// union of both sets.
         ///
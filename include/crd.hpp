@@ -85,5 +85,11 @@ class Xfer
         // function.
         inline mword subspaces() const { return ((xfer_meta >> 8) & 0x7) ^ 1; }
 
+        inline bool cow_pool() const { return flags() & 0x20; }
+
+        inline bool share() const { return flags() & 0x40; }
+
+        inline bool copy_on_write() const { return flags() & 0x80; }
+
         inline bool from_kern() const { return flags() & 0x800; }
 };
@@ -0,0 +1,110 @@
+/*
+ * Derivation tree of the mapping database
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "atomic.hpp"
+#include "types.hpp"
+
+// The linking of mapping database nodes into their derivation trees.
+//
+// Each derivation tree is a circular doubly linked list in depth-first order
+// that starts at its root, which is the only node with depth zero. Nodes are
+// only ever linked into the tree of their parent, so trees never merge and
+// all changes to a tree are serialized by the tree lock of its root. Changes
+// to different trees proceed in parallel.
+//
+// Lists are traversed without the lock (see Pd::revoke), so unlinked nodes
+// have to stay valid until all readers are gone. The parent pointer of a
+// node never changes, which makes it safe to follow to the root of a node
+// that is concurrently unlinked.
+//
+// NODE has to provide the prev, next, prnt, dpth, node_attr and tree_lock
+// members. GUARD is a scoped lock for the type of tree_lock.
+template <typename NODE, typename GUARD>
+class Derivation_tree
+{
+    public:
+        // Returns the lock of the tree of node n.
+        static auto &lock (NODE *n)
+        {
+            while (n->prnt) {
+                n = n->prnt;
+            }
+
+            return n->tree_lock;
+        }
+
+        // Returns true, if the node is linked into a tree. Only meaningful
+        // with the tree lock held.
+        static bool alive (NODE const *n) { return n->prev->next == n and n->next->prev == n; }
+
+        // Link node n as the first child of p with the attributes of p that
+        // are also in a. Fails, if p was unlinked or n would not have any
+        // attributes.
+        static bool insert (NODE *n, NODE *p, mword a)
+        {
+            GUARD guard (lock (p));
+
+            if (not alive (p)) {
+                return false;
+            }
+
+            if (not (n->node_attr = static_cast<decltype (n->node_attr)>(p->node_attr & a))) {
+                return false;
+            }
+
+            n->prev = n->prnt = p;
+            n->next = p->next;
+            n->dpth = static_cast<decltype (n->dpth)>(p->dpth + 1);
+            p->next = p->next->prev = n;
+
+            return true;
+        }
+
+        // Remove the attributes a from node n.
+        static void demote (NODE *n, mword a)
+        {
+            GUARD guard (lock (n));
+
+            n->node_attr = static_cast<decltype (n->node_attr)>(n->node_attr & ~a);
+        }
+
+        // Unlink node n from its tree. Fails, if n still has attributes or
+        // children or was already unlinked.
+        static bool remove (NODE *n)
+        {
+            if (Atomic::load (n->node_attr)) {
+                return false;
+            }
+
+            GUARD guard (lock (n));
+
+            if (not alive (n)) {
+                return false;
+            }
+
+            if (n->next->dpth > n->dpth) {
+                return false;
+            }
+
+            n->next->prev = n->prev;
+            n->prev->next = n->next;
+
+            return true;
+        }
+};
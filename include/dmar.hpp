@@ -94,6 +94,9 @@ class Dmar : public Forward_list<Dmar>
         static Dmar_irt *   irt;
         static uint32       gcmd;
 
+        // Whether all IOMMUs can walk EPT page tables. See can_share_ept().
+        static bool         ept_walk;
+
         static Dmar *       list;
         static Slab_cache   cache;
 
@@ -144,6 +147,12 @@ class Dmar : public Forward_list<Dmar>
 
         inline unsigned qi() const { return static_cast<unsigned>(ecap) & 0x2; }
 
+        // Page walks snoop the CPU caches.
+        inline bool coherent() const { return ecap & 0x1; }
+
+        // Four-level (48-bit) page tables are supported.
+        inline bool four_levels() const { return cap >> 8 & 0b00100; }
+
         // Return the number of supported page table levels.
         int page_table_levels() const;
 
@@ -254,6 +263,14 @@ class Dmar : public Forward_list<Dmar>
 
         void assign (unsigned long, Pd *);
 
+        // Return true, if DMA for a PD can be translated by its EPT.
+        //
+        // VT-d second-level page tables use the same format as EPTs. The
+        // IOMMU ignores the memory type and execute bits of EPT entries, but
+        // it must walk four levels, snoop the page tables as EPTs are not
+        // flushed from caches, and support every superpage size the EPT uses.
+        static bool can_share_ept();
+
         REGPARM (1)
         static void vector (unsigned) asm ("msi_vector");
 };
@@ -41,6 +41,9 @@ class Dpt : public Dpt_page_table
 
             PTE_S = 1UL << 7,
             PTE_P = PTE_R | PTE_W,
+
+            // Ignored by hardware. See Generic_page_table::link_from.
+            PTE_L = 1UL << 11,
         };
 
         static constexpr pte_t mask {PTE_R | PTE_W};
@@ -52,6 +55,10 @@ class Dpt : public Dpt_page_table
         // calls will be used.
         static void lower_supported_leaf_levels(level_t level);
 
+        // Return the number of leaf levels all IOMMUs support or a negative
+        // value, if there are no IOMMUs.
+        static level_t get_supported_leaf_levels() { return supported_leaf_levels; }
+
         // Return the root pointer as if the page table had only the given
         // number of levels.
         //
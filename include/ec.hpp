@@ -99,6 +99,10 @@ class Ec : public Typed_kobject<Kobject::Type::EC>, public Refcount, public Queu
         static bool handle_exc_gp (Exc_regs *);
         static bool handle_exc_pf (Exc_regs *);
 
+        // Resolve a guest write to a copy-on-write page at the guest-physical
+        // address gpa. Returns false, if the VMM has to handle the fault.
+        static bool handle_guest_cow (mword gpa);
+
         NORETURN
         static inline void svm_exception (mword);
 
@@ -461,6 +465,12 @@ class Ec : public Typed_kobject<Kobject::Type::EC>, public Refcount, public Queu
         NORETURN
         static void sys_machine_ctrl_update_microcode();
 
+        NORETURN
+        static void sys_machine_ctrl_page_table_stats();
+
+        NORETURN
+        static void sys_machine_ctrl_tlb_stats();
+
         NORETURN
         static void root_invoke();
 
@@ -24,7 +24,7 @@
 
 class Ept;
 using Ept_page_table = Generic_page_table<9, mword, Atomic_access_policy<>, No_clflush_policy,
-                                          Page_alloc_policy<>, Tlb_cleanup, Ept>;
+                                          Page_alloc_policy<>, Tlb_cleanup, Ept, 4>;
 
 class Ept : public Ept_page_table
 {
@@ -67,14 +67,24 @@ class Ept : public Ept_page_table
 
             PTE_I = 1UL << 6,
             PTE_S = 1UL << 7,
+
+            // Ignored by hardware. See Generic_page_table::link_from.
+            PTE_L = 1UL << 11,
+
+            // Marks read-only leaf entries that are copied when the guest
+            // writes to them. See Space_mem::resolve_cow.
+            PTE_COW = 1UL << 52,
         };
 
-        static constexpr pte_t mask {PTE_R | PTE_W | PTE_X | PTE_I | PTE_MT_MASK};
+        static constexpr pte_t mask {PTE_R | PTE_W | PTE_X | PTE_I | PTE_MT_MASK | PTE_COW};
         static constexpr pte_t all_rights {PTE_R | PTE_W | PTE_X};
 
         // Adjust the number of leaf levels to the given value.
         static void set_supported_leaf_levels(level_t level);
 
+        // Return the number of leaf levels new EPTs are created with.
+        static level_t get_supported_leaf_levels() { return supported_leaf_levels; }
+
         // Create a page table from scratch.
         Ept() : Ept_page_table(4, supported_leaf_levels) {}
 
@@ -18,6 +18,7 @@
 #pragma once
 
 #include "assert.hpp"
+#include "atomic.hpp"
 #include "compiler.hpp"
 #include "math.hpp"
 #include "memory.hpp"
@@ -29,7 +30,8 @@
 // features:
 //
 // - compile-time configurable entry types, attributes, and memory access
-// - run-time configurable page table levels (useful for Intel IOMMUs)
+// - run-time configurable page table levels (useful for Intel IOMMUs) or, if
+//   LEVELS is non-zero, a fixed number of levels known at compile time
 // - atomic page table updates on PAGE_SIZE granularity
 //
 // Access to memory is handled via the MEMORY class template parameter. Memory
@@ -46,11 +48,11 @@
 // overlapping region, the updates may be arbitrarily interleaved.
 //
 template <int BITS_PER_LEVEL, typename ENTRY, typename MEMORY, typename CACHE_FLUSH,
-          typename PAGE_ALLOC, typename DEFERRED_CLEANUP, typename ATTR>
+          typename PAGE_ALLOC, typename DEFERRED_CLEANUP, typename ATTR, int LEVELS = 0>
 class Generic_page_table
 {
         using this_t = Generic_page_table<BITS_PER_LEVEL, ENTRY, MEMORY, CACHE_FLUSH,
-                                          PAGE_ALLOC, DEFERRED_CLEANUP, ATTR>;
+                                          PAGE_ALLOC, DEFERRED_CLEANUP, ATTR, LEVELS>;
 
     public:
         using level_t = int;
@@ -62,6 +64,9 @@ class Generic_page_table
         using pte_t = ENTRY;
         using pte_pointer_t = typename MEMORY::pointer;
 
+        // The class that defines the entry bits.
+        using attr_t = ATTR;
+
         struct Mapping
         {
             public:
@@ -116,6 +121,35 @@ class Generic_page_table
                 }
         };
 
+        // A list of zeroed pages that are reserved for page table updates.
+        //
+        // Page table updates that are given a pool take new page tables from
+        // it instead of calling into the page allocator. The pool is filled
+        // with reserve() and returned to the page allocator with release().
+        class Page_pool
+        {
+                friend this_t;
+
+                // The pages are chained via their first entry, which holds
+                // the physical address of the next page.
+                pte_pointer_t head_ {nullptr};
+                size_t size_ {0};
+
+            public:
+                // Returns the number of pages in the pool.
+                size_t size() const { return size_; }
+
+                Page_pool &operator=(Page_pool const &rhs) = delete;
+                Page_pool(Page_pool const &rhs) = delete;
+
+                Page_pool() = default;
+
+                ~Page_pool()
+                {
+                    assert (size_ == 0);
+                }
+        };
+
     private:
 
         MEMORY      memory_;
@@ -135,6 +169,14 @@ class Generic_page_table
         // The root of the page table hierarchy.
         pte_pointer_t root_;
 
+        // The number of page tables that are reachable from this page table
+        // including the root. Page tables that are linked from another page
+        // table (see link_from) are not counted. Shared page tables (see
+        // share_from) count for every page table that references them. For
+        // a page table that was created from an existing root, this only
+        // counts the difference to the page tables that existed at that time.
+        long table_pages_ {0};
+
         // Return the order that an entry at a specific page table level has.
         ord_t level_order(level_t level) const { return level * BITS_PER_LEVEL + PAGE_BITS; }
 
@@ -158,21 +200,72 @@ class Generic_page_table
             return level == 0 or not (entry & ATTR::PTE_P) or is_superpage (level, entry);
         }
 
+        // Returns the physical address an entry points to. PTE_L is a
+        // software bit and not part of ATTR::mask, so it has to be stripped
+        // separately from linked table entries.
+        static phys_t entry_to_phys(pte_t entry)
+        {
+            static_assert ((ATTR::PTE_L & ATTR::mask) == 0,
+                           "Can't have the link bit in user configurable page table bits");
+
+            return entry & ~(ATTR::mask | ATTR::PTE_L);
+        }
+
+        // Walk down to the leaf entry that maps vaddr. For fixed-depth page
+        // tables, the number of iterations is known at compile time and the
+        // loop can be unrolled.
         Mapping lookup(virt_t vaddr, pte_pointer_t pte_p, level_t cur_level)
         {
-            assert_slow (cur_level >= 0 and cur_level < max_levels_);
+            for (;; cur_level--) {
+                assert_slow (cur_level >= 0 and cur_level < max_levels());
+
+                pte_t  const entry {memory_.read (pte_p + virt_to_index (cur_level, vaddr))};
+                phys_t const phys  {entry_to_phys(entry)};
+
+                if (is_leaf (cur_level, entry)) {
+                    ord_t const map_order {level_order(cur_level)};
+                    ENTRY const mask {(static_cast<ENTRY>(1) << map_order) - 1};
+
+                    return Mapping {vaddr & ~mask, phys & ~mask, entry & ATTR::mask, map_order};
+                }
+
+                pte_p = page_alloc_.phys_to_pointer (phys);
+            }
+        }
+
+        // Allocate a zeroed page table from the pool or, if there is no pool,
+        // from the page allocator.
+        //
+        // The pool is sized by max_new_tables before the update. Concurrent
+        // updates of the same region may still make the update need more
+        // page tables than counted. These come from the page allocator.
+        pte_pointer_t alloc_table(Page_pool *pool)
+        {
+            if (pool == nullptr or pool->size_ == 0) {
+                return page_alloc_.alloc_zeroed_page();
+            }
+
+            pte_pointer_t const page {pool->head_};
+            phys_t const next {memory_.read (page)};
 
-            pte_t  const entry {memory_.read (pte_p + virt_to_index (cur_level, vaddr))};
-            phys_t const phys  {entry & ~ATTR::mask};
+            memory_.write (page, 0);
 
-            if (is_leaf (cur_level, entry)) {
-                ord_t const map_order {level_order(cur_level)};
-                ENTRY const mask {(static_cast<ENTRY>(1) << map_order) - 1};
+            pool->head_ = --pool->size_ > 0 ? page_alloc_.phys_to_pointer (next) : nullptr;
+            return page;
+        }
 
-                return Mapping {vaddr & ~mask, phys & ~mask, entry & ATTR::mask, map_order};
+        // Return a zeroed page table that was never linked into the page table.
+        void free_table(Page_pool *pool, pte_pointer_t page)
+        {
+            if (pool == nullptr) {
+                page_alloc_.free_page (page);
+                return;
             }
 
-            return lookup (vaddr, page_alloc_.phys_to_pointer (phys), cur_level - 1);
+            memory_.write (page, pool->size_ > 0 ? page_alloc_.pointer_to_phys (pool->head_) : 0);
+
+            pool->head_ = page;
+            pool->size_++;
         }
 
         // Use a superpage from the given level to fill out a new page table one
@@ -192,112 +285,306 @@ class Generic_page_table
             flush_cache_page (new_table);
         }
 
+        // Undo fill_from_superpage for a page table that was never linked into
+        // the page table.
+        void zero_table(pte_pointer_t table)
+        {
+            for (size_t i {0}; i < static_cast<size_t>(1) << BITS_PER_LEVEL; i++) {
+                memory_.write (table + i, 0);
+            }
+        }
+
         // See the description of the public version of this function below.
-        pte_pointer_t walk_down_and_split(DEFERRED_CLEANUP &cleanup, virt_t vaddr, level_t to_level, pte_pointer_t pte_p,
-                                          level_t cur_level, bool create)
+        pte_pointer_t walk_down_and_split(DEFERRED_CLEANUP &cleanup, Page_pool *pool, virt_t vaddr, level_t to_level,
+                                          pte_pointer_t pte_p, level_t cur_level, bool create)
         {
-            assert_slow (cur_level >= 0 and cur_level <  max_levels_);
+            assert_slow (cur_level >= 0 and cur_level <  max_levels());
             assert_slow (to_level  >= 0 and to_level  <= cur_level);
 
-            if (to_level == cur_level) {
-                return pte_p;
-            }
+            for (; cur_level != to_level; cur_level--) {
+            retry:
 
-        retry:
+                auto   entry_p {pte_p + virt_to_index (cur_level, vaddr)};
+                pte_t  entry   {memory_.read (entry_p)};
+                phys_t phys    {entry_to_phys(entry)};
 
-            auto   entry_p {pte_p + virt_to_index (cur_level, vaddr)};
-            pte_t  entry   {memory_.read (entry_p)};
-            phys_t phys    {entry & ~ATTR::mask};
+                assert_slow (cur_level != 0);
 
-            assert_slow (cur_level != 0);
+                // In case there is no mapping and we want to downgrade rights, we
+                // can already stop.
+                if (not (entry & ATTR::PTE_P) and not create) {
+                    return nullptr;
+                }
 
-            // In case there is no mapping and we want to downgrade rights, we
-            // can already stop.
-            if (not (entry & ATTR::PTE_P) and not create) {
-                return nullptr;
-            }
+                // We have hit a leaf entry, but need to recurse further. Create the
+                // next page table level.
+                if (not (entry & ATTR::PTE_P) or is_superpage (cur_level, entry)) {
+                    auto   const new_page  {alloc_table (pool)};
+                    phys_t const new_phys  {page_alloc_.pointer_to_phys (new_page)};
+                    pte_t  const new_entry {new_phys | (ATTR::all_rights & ~ATTR::PTE_S)};
+
+                    // Initialize the new page table with content from the former
+                    // superpage.
+                    if (is_superpage (cur_level, entry)) {
+                        ord_t const entry_order {level_order (cur_level)};
+
+                        fill_from_superpage (new_page, entry, cur_level);
+                        cleanup.flush_tlb_later (vaddr & ~((static_cast<virt_t>(1) << entry_order) - 1),
+                                                 static_cast<virt_t>(1) << entry_order, entry_order);
+                    } else {
+                        flush_cache_page (new_page);
+                    }
+
+                    // If we fail to install a pointer to the new page, we can
+                    // reclaim it immediately, because no other CPU holds a
+                    // reference.
+                    if (not memory_.cmp_swap (entry_p, entry, new_entry)) {
+                        if (is_superpage (cur_level, entry)) {
+                            zero_table (new_page);
+                        }
 
-            // We have hit a leaf entry, but need to recurse further. Create the
-            // next page table level.
-            if (not (entry & ATTR::PTE_P) or is_superpage (cur_level, entry)) {
-                auto   const new_page  {page_alloc_.alloc_zeroed_page()};
-                phys_t const new_phys  {page_alloc_.pointer_to_phys (new_page)};
-                pte_t  const new_entry {new_phys | (ATTR::all_rights & ~ATTR::PTE_S)};
+                        free_table (pool, new_page);
+                        goto retry;
+                    }
 
-                // Initialize the new page table with content from the former
-                // superpage.
-                if (is_superpage (cur_level, entry)) {
-                    fill_from_superpage (new_page, entry, cur_level);
-                    cleanup.flush_tlb_later();
-                }
+                    flush_cache_entries (cleanup, entry_p, 1);
+                    Atomic::add (table_pages_, 1L);
 
-                // If we fail to install a pointer to the new page, we can
-                // reclaim it immediately, because no other CPU holds a
-                // reference.
-                if (not memory_.cmp_swap (entry_p, entry, new_entry)) {
-                    page_alloc_.free_page (new_page);
+                    entry = new_entry;
+                    phys  = new_phys;
+                } else if (not unshare (cleanup, pool, entry_p, entry, cur_level, vaddr)) {
                     goto retry;
+                } else {
+                    phys = entry_to_phys(entry);
                 }
 
-                flush_cache_entries (entry_p, 1);
-
-                entry = new_entry;
-                phys  = new_phys;
+                assert_slow (not is_leaf (cur_level, entry));
+                pte_p = page_alloc_.phys_to_pointer (phys);
             }
 
-            assert_slow (not is_leaf (cur_level, entry));
-            return walk_down_and_split (cleanup, vaddr, to_level, page_alloc_.phys_to_pointer (phys),
-                                        cur_level - 1, create);
+            return pte_p;
         }
 
-        // Free any page tables referenced from a page table entry.
+        // Free any page tables referenced from a page table entry and schedule
+        // the TLB invalidation for the region it translated at vaddr.
         //
         // Assumes that the given page table entry is already removed from the
         // page table.
-        NOINLINE void cleanup(DEFERRED_CLEANUP &cleanup_state, pte_t pte, level_t cur_level)
+        NOINLINE void cleanup(DEFERRED_CLEANUP &cleanup_state, pte_t pte, level_t cur_level, virt_t vaddr)
         {
-            assert_slow (cur_level >= 0 and cur_level < max_levels_);
+            assert_slow (cur_level >= 0 and cur_level < max_levels());
+
+            ord_t const entry_order {level_order (cur_level)};
+            virt_t const entry_size {static_cast<virt_t>(1) << entry_order};
 
             if (is_leaf (cur_level, pte)) {
                 if (pte & ATTR::PTE_P) {
-                    cleanup_state.flush_tlb_later();
+                    cleanup_state.flush_tlb_later (vaddr, entry_size, entry_order);
                 }
+            } else if (pte & ATTR::PTE_L) {
+                // Linked page tables belong to another page table (see
+                // link_from). We only drop our reference to them.
+                cleanup_state.flush_tlb_later (vaddr, entry_size, PAGE_BITS);
             } else {
-                cleanup_table(cleanup_state, page_alloc_.phys_to_pointer (pte & ~ATTR::mask),
-                              cur_level);
+                pte_pointer_t const table {page_alloc_.phys_to_pointer (entry_to_phys(pte))};
+
+                // Once we dropped our reference, another page table may free
+                // the shared page table, so it is counted before.
+                long const tables {page_alloc_.is_shared_page (table) ? count_tables (table, cur_level) : 0};
+
+                if (page_alloc_.unref_page (table)) {
+                    cleanup_table(cleanup_state, table, cur_level, vaddr);
+                } else {
+                    // Other page tables still share this page table (see
+                    // share_from). The last one frees it.
+                    cleanup_state.flush_tlb_later (vaddr, entry_size, PAGE_BITS);
+                    Atomic::sub (table_pages_, tables);
+                }
             }
         }
 
+        // Returns the number of page tables that the given page table
+        // references including itself. Linked page tables are not counted.
+        long count_tables(pte_pointer_t table, level_t cur_level) const
+        {
+            long tables {1};
+
+            for (size_t i {0}; i < static_cast<size_t>(1) << BITS_PER_LEVEL; i++) {
+                pte_t const entry {memory_.read (table + i)};
+
+                if (not is_leaf (cur_level - 1, entry) and not (entry & ATTR::PTE_L)) {
+                    tables += count_tables (page_alloc_.phys_to_pointer (entry_to_phys(entry)), cur_level - 1);
+                }
+            }
+
+            return tables;
+        }
+
+        // Replace a reference to a page table that is shared with other page
+        // tables (see share_from) with a private copy, before we modify it.
+        //
+        // The page tables below the copy are shared between the copy and the
+        // original afterwards. Returns false, if the entry changed
+        // concurrently. Otherwise, entry holds the current entry.
+        bool unshare(DEFERRED_CLEANUP &cleanup_state, Page_pool *pool, pte_pointer_t entry_p, pte_t &entry,
+                     level_t cur_level, virt_t vaddr)
+        {
+            assert_slow (cur_level > 0 and not is_leaf (cur_level, entry));
+
+            pte_pointer_t const shared {page_alloc_.phys_to_pointer (entry_to_phys(entry))};
+
+            if ((entry & ATTR::PTE_L) or not page_alloc_.is_shared_page (shared)) {
+                return true;
+            }
+
+            virt_t const table_vaddr {vaddr & ~((static_cast<virt_t>(1) << level_order (cur_level)) - 1)};
+
+            auto const copy {alloc_table (pool)};
+
+            for (size_t i {0}; i < static_cast<size_t>(1) << BITS_PER_LEVEL; i++) {
+                pte_t const child {memory_.read (shared + i)};
+
+                if (not is_leaf (cur_level - 1, child) and not (child & ATTR::PTE_L)) {
+                    page_alloc_.ref_page (page_alloc_.phys_to_pointer (entry_to_phys(child)));
+                }
+
+                memory_.write (copy + i, child);
+            }
+
+            flush_cache_page (copy);
+
+            pte_t const new_entry {page_alloc_.pointer_to_phys (copy) | (entry & ATTR::mask)};
+
+            if (not memory_.cmp_swap (entry_p, entry, new_entry)) {
+                for (size_t i {0}; i < static_cast<size_t>(1) << BITS_PER_LEVEL; i++) {
+                    pte_t const child {memory_.read (copy + i)};
+
+                    if (is_leaf (cur_level - 1, child) or (child & ATTR::PTE_L)) {
+                        continue;
+                    }
+
+                    // Drop the references we took above. This page table never
+                    // counted them, so freeing them must not change its count.
+                    pte_pointer_t const table {page_alloc_.phys_to_pointer (entry_to_phys(child))};
+                    long const tables {count_tables (table, cur_level - 1)};
+
+                    if (page_alloc_.unref_page (table)) {
+                        cleanup_table (cleanup_state, table, cur_level - 1,
+                                       table_vaddr + (static_cast<virt_t>(i) << level_order (cur_level - 1)));
+                        Atomic::add (table_pages_, tables);
+                    }
+                }
+
+                zero_table (copy);
+                free_table (pool, copy);
+                return false;
+            }
+
+            // The copy translates exactly like the shared page table, so no
+            // TLB entry becomes stale. Whoever modifies the copy next
+            // invalidates the cached paging structures along with it.
+            //
+            // The copy replaces the shared page table and references the
+            // same page tables below it, so the number of page tables that
+            // this page table reaches stays the same. If we held the last
+            // reference, the copy took over the references of the original.
+            if (page_alloc_.unref_page (shared)) {
+                for (size_t i {0}; i < static_cast<size_t>(1) << BITS_PER_LEVEL; i++) {
+                    pte_t const child {memory_.read (shared + i)};
+
+                    if (is_leaf (cur_level - 1, child) or (child & ATTR::PTE_L)) {
+                        continue;
+                    }
+
+                    // The copy still references the page table.
+                    [[maybe_unused]] bool const last {page_alloc_.unref_page (
+                                                          page_alloc_.phys_to_pointer (entry_to_phys(child)))};
+                    assert (not last);
+                }
+
+                cleanup_state.free_later (shared);
+            }
+
+            flush_cache_entries (cleanup_state, entry_p, 1);
+
+            entry = new_entry;
+            return true;
+        }
+
+        // Returns true, if pred holds for all present leaf entries in the
+        // given page table and the page tables below it.
+        template <typename FN>
+        bool all_leaves(pte_pointer_t table, level_t cur_level, FN const &pred) const
+        {
+            for (size_t i {0}; i < static_cast<size_t>(1) << BITS_PER_LEVEL; i++) {
+                pte_t const entry {memory_.read (table + i)};
+
+                if (not (entry & ATTR::PTE_P)) {
+                    continue;
+                }
+
+                if (is_leaf (cur_level, entry) ? not pred (static_cast<pte_t>(entry & ATTR::mask))
+                                               : not all_leaves (page_alloc_.phys_to_pointer (entry_to_phys(entry)),
+                                                                 cur_level - 1, pred)) {
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
         // Free any page tables referenced from the given page table including
-        // itself. Companion function to cleanup().
-        void cleanup_table(DEFERRED_CLEANUP &cleanup_state, pte_pointer_t table, level_t cur_level)
+        // itself. The table translates addresses starting at table_vaddr.
+        // Companion function to cleanup().
+        void cleanup_table(DEFERRED_CLEANUP &cleanup_state, pte_pointer_t table, level_t cur_level, virt_t table_vaddr)
         {
-            assert_slow (cur_level > 0 and cur_level <= max_levels_);
+            assert_slow (cur_level > 0 and cur_level <= max_levels());
 
             for (size_t i {0}; i < static_cast<size_t>(1) << BITS_PER_LEVEL; i++) {
-                cleanup(cleanup_state, memory_.read (table + i), cur_level - 1);
+                cleanup(cleanup_state, memory_.read (table + i), cur_level - 1,
+                        table_vaddr + (static_cast<virt_t>(i) << level_order (cur_level - 1)));
             }
 
             cleanup_state.free_later (table);
+            Atomic::sub (table_pages_, 1L);
         }
 
         // Cache flush a number of page table entries.
-        void flush_cache_entries(pte_pointer_t pte_p, size_t n)
+        //
+        // The flush is deferred until flush_cache_pending is called. This
+        // allows coalescing the flushes of an update operation.
+        void flush_cache_entries(DEFERRED_CLEANUP &cleanup_state, pte_pointer_t pte_p, size_t n)
+        {
+            if constexpr (CACHE_FLUSH::noncoherent) {
+                cleanup_state.flush_cache_later (cache_flush_, pte_p, n * sizeof(ENTRY));
+            }
+        }
+
+        // Write back all deferred cache flushes. This has to happen before
+        // the update is visible to non-coherent page table walkers, e.g. before
+        // invalidating IOTLBs.
+        void flush_cache_pending(DEFERRED_CLEANUP &cleanup_state)
         {
-            cache_flush_.clflush (pte_p, n * sizeof(ENTRY));
+            if constexpr (CACHE_FLUSH::noncoherent) {
+                cleanup_state.flush_caches (cache_flush_);
+            }
         }
 
+        // Cache flush a whole page table immediately.
+        //
+        // New page tables must be flushed before they are linked into the page
+        // table. Otherwise, a page table walker may see stale memory contents.
         void flush_cache_page(pte_pointer_t pte_p)
         {
-            flush_cache_entries (pte_p, static_cast<size_t>(1) << BITS_PER_LEVEL);
+            cache_flush_.clflush (pte_p, sizeof(ENTRY) << BITS_PER_LEVEL);
         }
 
         // Recursively update page table structures with new mappings.
-        NOINLINE void fill_entries(DEFERRED_CLEANUP &cleanup_state, pte_pointer_t table, level_t cur_level,
-                                   Mapping const &map)
+        NOINLINE void fill_entries(DEFERRED_CLEANUP &cleanup_state, Page_pool *pool, pte_pointer_t table,
+                                   level_t cur_level, Mapping const &map)
         {
             assert_slow (table != nullptr);
-            assert_slow (cur_level >= 0 and cur_level < max_levels_);
+            assert_slow (cur_level >= 0 and cur_level < max_levels());
 
             ord_t const entry_order {level_order(cur_level)};
             [[maybe_unused]] ord_t const table_order {level_order(cur_level + 1)};
@@ -327,7 +614,7 @@ class Generic_page_table
                     pte_t const new_attr {map.attr | (create_superpages ? static_cast<pte_t>(ATTR::PTE_S) : 0)};
                     pte_t const new_pte {clear_mappings ? 0 : (map.paddr | addr_offset | new_attr)};
 
-                    cleanup (cleanup_state, memory_.exchange (pte_p, new_pte), cur_level);
+                    cleanup (cleanup_state, memory_.exchange (pte_p, new_pte), cur_level, map.vaddr + addr_offset);
                 } else {
                 retry:
 
@@ -337,34 +624,153 @@ class Generic_page_table
                     // no page table yet.
                     if (not (old_pte & ATTR::PTE_P)) {
 
-                        auto  const zero_page {page_alloc_.alloc_zeroed_page()};
+                        auto  const zero_page {alloc_table (pool)};
                         pte_t const new_pte {page_alloc_.pointer_to_phys (zero_page) | ATTR::all_rights};
                         flush_cache_page (zero_page);
 
                         if (not memory_.cmp_swap (pte_p, old_pte, new_pte)) {
-                            page_alloc_.free_page (zero_page);
+                            free_table (pool, zero_page);
                             goto retry;
                         }
 
-                        cleanup (cleanup_state, old_pte, cur_level);
+                        cleanup (cleanup_state, old_pte, cur_level, map.vaddr + addr_offset);
+                        Atomic::add (table_pages_, 1L);
                         old_pte = new_pte;
+                    } else if (not unshare (cleanup_state, pool, pte_p, old_pte, cur_level, map.vaddr + addr_offset)) {
+                        goto retry;
                     }
 
                     Mapping const sub_map {map.vaddr + addr_offset, map.paddr + addr_offset,
                             map.attr, entry_order};
 
-                    fill_entries (cleanup_state, page_alloc_.phys_to_pointer (old_pte & ~ATTR::mask),
+                    fill_entries (cleanup_state, pool, page_alloc_.phys_to_pointer (entry_to_phys(old_pte)),
                                   cur_level - 1, sub_map);
                 }
             }
 
-            flush_cache_entries (table + offset, static_cast<size_t>(1) << updated_order);
+            flush_cache_entries (cleanup_state, table + offset, static_cast<size_t>(1) << updated_order);
+        }
+
+        // Recursively downgrade the rights of the leaf entries that map
+        // addresses in [first, last]. The given table maps addresses starting
+        // at table_vaddr.
+        template <typename FN>
+        void protect_entries(DEFERRED_CLEANUP &cleanup_state, pte_pointer_t table, level_t cur_level,
+                             virt_t table_vaddr, virt_t first, virt_t last, FN const &downgrade)
+        {
+            assert_slow (cur_level >= 0 and cur_level < max_levels());
+
+            ord_t  const entry_order {level_order (cur_level)};
+            virt_t const entry_mask  {(static_cast<virt_t>(1) << entry_order) - 1};
+            virt_t const table_last  {table_vaddr + ((static_cast<virt_t>(1) << level_order (cur_level + 1)) - 1)};
+
+            size_t const first_index {virt_to_index (cur_level, max (first, table_vaddr))};
+            size_t const last_index  {virt_to_index (cur_level, min (last, table_last))};
+
+            for (size_t i {first_index}; i <= last_index; i++) {
+                virt_t        const entry_first {table_vaddr + (static_cast<virt_t>(i) << entry_order)};
+                pte_pointer_t const pte_p       {table + i};
+
+            retry:
+
+                pte_t const old_pte {memory_.read (pte_p)};
+
+                // Linked page tables belong to another page table (see
+                // link_from) and are not ours to modify.
+                if (not (old_pte & ATTR::PTE_P) or (not is_leaf (cur_level, old_pte) and (old_pte & ATTR::PTE_L))) {
+                    continue;
+                }
+
+                if (is_leaf (cur_level, old_pte)) {
+                    pte_t const new_pte {(old_pte & ~ATTR::mask) | downgrade (static_cast<pte_t>(old_pte & ATTR::mask))};
+
+                    if (new_pte == old_pte) {
+                        continue;
+                    }
+
+                    // Entries that are completely covered are changed in
+                    // place, which keeps superpages intact.
+                    if (entry_first >= first and entry_first + entry_mask <= last) {
+                        if (not memory_.cmp_swap (pte_p, old_pte, new_pte)) {
+                            goto retry;
+                        }
+
+                        cleanup (cleanup_state, old_pte, cur_level, entry_first);
+                        flush_cache_entries (cleanup_state, pte_p, 1);
+                        continue;
+                    }
+                }
+
+                // Either a page table or a superpage that is only partially
+                // covered and has to be split first.
+                pte_pointer_t const next {walk_down_and_split (cleanup_state, nullptr, entry_first, cur_level - 1,
+                                                               table, cur_level, false)};
+
+                if (next != nullptr) {
+                    protect_entries (cleanup_state, next, cur_level - 1, entry_first, first, last, downgrade);
+                }
+            }
+        }
+
+        // Returns true, if modifying the page table that entry points to
+        // needs a private copy first (see unshare). Copying a page table
+        // shares the page tables below it, so they need copies as well.
+        bool needs_copy(pte_t entry, bool parent_copied) const
+        {
+            if (entry & ATTR::PTE_L) {
+                return false;
+            }
+
+            return parent_copied or page_alloc_.is_shared_page (page_alloc_.phys_to_pointer (entry_to_phys(entry)));
+        }
+
+        // Returns the number of page tables that filling a single empty entry
+        // at the given level needs. Levels that can hold leaf entries need
+        // none.
+        size_t empty_entry_tables(level_t level) const
+        {
+            size_t tables {0};
+
+            for (level_t cur_level {leaf_levels_}; cur_level <= level; cur_level++) {
+                tables = 1 + (static_cast<size_t>(1) << BITS_PER_LEVEL) * tables;
+            }
+
+            return tables;
+        }
+
+        // Returns the number of page tables that filling the given entries of
+        // a page table needs (see fill_entries). If copied is true, the page
+        // table is a copy of a shared page table.
+        size_t fill_tables(pte_pointer_t table, level_t cur_level, size_t first, size_t count, bool copied) const
+        {
+            if (cur_level == 0 or cur_level < leaf_levels_) {
+                return 0;
+            }
+
+            size_t tables {0};
+
+            for (size_t i {first}; i < first + count; i++) {
+                pte_t const entry {memory_.read (table + i)};
+
+                if (not (entry & ATTR::PTE_P)) {
+                    tables += empty_entry_tables (cur_level);
+                    continue;
+                }
+
+                bool const copy {needs_copy (entry, copied)};
+
+                tables += (copy ? 1 : 0) + fill_tables (page_alloc_.phys_to_pointer (entry_to_phys(entry)),
+                                                        cur_level - 1, 0, static_cast<size_t>(1) << BITS_PER_LEVEL,
+                                                        copy);
+            }
+
+            return tables;
         }
 
     public:
 
         // The maximum possible mapping order.
-        ord_t max_order() const { return max_levels_ * BITS_PER_LEVEL + PAGE_BITS; }
+        ord_t max_order() const { return max_levels() * BITS_PER_LEVEL + PAGE_BITS; }
 
         // Return the memory abstraction as a unit testing aid.
         MEMORY const &memory() const { return memory_; }
@@ -373,7 +779,14 @@ class Generic_page_table
         PAGE_ALLOC const &page_alloc() const { return page_alloc_; }
 
         // Returns the total number of levels this page table has.
-        level_t max_levels() const { return max_levels_; }
+        level_t max_levels() const
+        {
+            if constexpr (LEVELS > 0) {
+                return LEVELS;
+            } else {
+                return max_levels_;
+            }
+        }
 
         // Returns the number of page table levels that can have leaf
         // entries. For a 4-level page table that only supports 2MB pages, this
@@ -381,6 +794,11 @@ class Generic_page_table
         // terminate the page walk.
         level_t leaf_levels() const { return leaf_levels_; }
 
+        // Returns the number of page tables in use by this page table. Page
+        // tables that are shared with other page tables count for each of
+        // them. See table_pages_ for details.
+        long table_pages() const { return Atomic::load (table_pages_); }
+
         // Returns the root of the page table. This is usually what ends up in
         // the Page Directory Base Register (PDBR / CR3).
         phys_t root() const { return page_alloc_.pointer_to_phys(root_); }
@@ -393,7 +811,7 @@ class Generic_page_table
         {
             assert_slow (root_ != nullptr);
 
-            Mapping const result {lookup (vaddr, root_, max_levels_ - 1)};
+            Mapping const result {lookup (vaddr, root_, max_levels() - 1)};
 
             // The end of the final translation will wrap to zero.
             assert_slow (result.vaddr <= vaddr and
@@ -423,12 +841,188 @@ class Generic_page_table
                                           level_t to_level, bool create = true)
         {
             assert_slow (root_ != nullptr);
-            return walk_down_and_split (cleanup, vaddr, to_level, root_, max_levels_ - 1, create);
+
+            pte_pointer_t const table {walk_down_and_split (cleanup, nullptr, vaddr, to_level, root_, max_levels() - 1,
+                                                            create)};
+            flush_cache_pending (cleanup);
+
+            return table;
+        }
+
+        // Link the page table structures of src that translate the naturally
+        // aligned region at vaddr with the given order into this page table.
+        //
+        // Afterwards, both page tables share the translations for this region
+        // and modifications via either page table are visible in both. The
+        // linked page tables stay owned by src and are never freed via this
+        // page table, so src has to outlive it. The order has to match a
+        // non-leaf page table entry in src.
+        void link_from(DEFERRED_CLEANUP &cleanup_state, this_t &src, virt_t vaddr, ord_t order)
+        {
+            level_t const level {(order - PAGE_BITS) / BITS_PER_LEVEL};
+
+            assert (level > 0 and level < max_levels() and order == level_order (level));
+            assert (src.max_levels() == max_levels() and is_aligned_by_order (vaddr, order));
+
+            DEFERRED_CLEANUP src_cleanup;
+            pte_pointer_t const src_table {src.walk_down_and_split (src_cleanup, vaddr, level, false)};
+            assert (src_table != nullptr and not src_cleanup.need_tlb_flush());
+
+            pte_t const src_entry {src.memory_.read (src_table + virt_to_index (level, vaddr))};
+            assert (not is_leaf (level, src_entry));
+
+            pte_pointer_t const table {walk_down_and_split (cleanup_state, nullptr, vaddr, level, root_, max_levels() - 1, true)};
+            pte_pointer_t const entry_p {table + virt_to_index (level, vaddr)};
+
+            cleanup (cleanup_state, memory_.exchange (entry_p, src_entry | ATTR::PTE_L), level, vaddr);
+            flush_cache_entries (cleanup_state, entry_p, 1);
+            flush_cache_pending (cleanup_state);
+        }
+
+        // Share the page table of src that translates the naturally aligned
+        // region at src_vaddr with the given order at dst_vaddr in this page
+        // table.
+        //
+        // Unlike link_from, the shared page tables are reference counted and
+        // belong to every page table that uses them. Whichever page table
+        // modifies the region first gets a private copy (see unshare), so
+        // later modifications are not visible in the other page tables. pred
+        // is called with the attributes of every present leaf entry in the
+        // region and has to accept all of them.
+        //
+        // Returns false without changing anything, if src has no page table
+        // for the region or pred rejects an entry.
+        template <typename FN>
+        bool share_from(DEFERRED_CLEANUP &cleanup_state, this_t &src, virt_t src_vaddr, virt_t dst_vaddr, ord_t order,
+                        FN const &pred)
+        {
+            level_t const level {(order - PAGE_BITS) / BITS_PER_LEVEL};
+
+            assert (level > 0 and level < max_levels() - 1 and order == level_order (level));
+            assert (src.max_levels() == max_levels());
+            assert (is_aligned_by_order (src_vaddr, order) and is_aligned_by_order (dst_vaddr, order));
+
+            // Find the page table entry in src without modifying src.
+            pte_pointer_t src_table {src.root_};
+
+            for (level_t cur_level {max_levels() - 1}; cur_level > level; cur_level--) {
+                pte_t const entry {src.memory_.read (src_table + virt_to_index (cur_level, src_vaddr))};
+
+                if (is_leaf (cur_level, entry) or (entry & ATTR::PTE_L)) {
+                    return false;
+                }
+
+                src_table = page_alloc_.phys_to_pointer (entry_to_phys(entry));
+            }
+
+            pte_pointer_t const src_entry_p {src_table + virt_to_index (level, src_vaddr)};
+            pte_t         const src_entry   {src.memory_.read (src_entry_p)};
+
+            if (is_leaf (level, src_entry) or (src_entry & ATTR::PTE_L)) {
+                return false;
+            }
+
+            pte_pointer_t const shared {page_alloc_.phys_to_pointer (entry_to_phys(src_entry))};
+
+            // Once we hold a reference and src still uses the page table, it
+            // cannot go away anymore. The shared page tables count for this
+            // page table from now on, which also balances the cleanup below,
+            // if sharing fails.
+            page_alloc_.ref_page (shared);
+            Atomic::add (table_pages_, count_tables (shared, level));
+
+            if (src.memory_.read (src_entry_p) != src_entry or not all_leaves (shared, level - 1, pred)) {
+                cleanup (cleanup_state, src_entry, level, dst_vaddr);
+                return false;
+            }
+
+            pte_pointer_t const table {walk_down_and_split (cleanup_state, nullptr, dst_vaddr, level, root_,
+                                                            max_levels() - 1, true)};
+            pte_pointer_t const entry_p {table + virt_to_index (level, dst_vaddr)};
+
+            cleanup (cleanup_state, memory_.exchange (entry_p, src_entry), level, dst_vaddr);
+            flush_cache_entries (cleanup_state, entry_p, 1);
+            flush_cache_pending (cleanup_state);
+
+            return true;
+        }
+
+        // Returns the number of page tables that an update with the given
+        // mapping needs to allocate. Existing page tables are taken into
+        // account, so updates of already populated regions need few or no
+        // new page tables.
+        size_t max_new_tables(Mapping const &map) const
+        {
+            level_t const modified_level {(map.order - PAGE_BITS) / BITS_PER_LEVEL};
+            size_t const  entries {static_cast<size_t>(1) << (map.order - level_order (modified_level))};
+
+            pte_pointer_t table  {root_};
+            size_t        tables {0};
+            bool          copied {false};
+
+            // Walking down creates missing page tables, splits superpages
+            // and copies shared page tables (see walk_down_and_split).
+            for (level_t cur_level {max_levels() - 1}; cur_level > modified_level; cur_level--) {
+                pte_t const entry {memory_.read (table + virt_to_index (cur_level, map.vaddr))};
+
+                if (not (entry & ATTR::PTE_P) and not map.present()) {
+                    return tables;
+                }
+
+                // All levels below are created from scratch or from the
+                // superpage.
+                if (is_leaf (cur_level, entry)) {
+                    tables += static_cast<size_t>(cur_level - modified_level);
+
+                    return map.present() ? tables + entries * empty_entry_tables (modified_level) : tables;
+                }
+
+                copied  = needs_copy (entry, copied);
+                tables += copied ? 1 : 0;
+                table   = page_alloc_.phys_to_pointer (entry_to_phys(entry));
+            }
+
+            if (not map.present()) {
+                return tables;
+            }
+
+            return tables + fill_tables (table, modified_level, virt_to_index (modified_level, map.vaddr), entries,
+                                         copied);
+        }
+
+        // Fill up the page pool until it holds at least the given number of
+        // pages. Returns false, if the page allocator ran out of memory. The
+        // pages that were reserved stay in the pool.
+        WARN_UNUSED_RESULT bool reserve(Page_pool &pool, size_t pages)
+        {
+            while (pool.size_ < pages) {
+                pte_pointer_t const page {page_alloc_.try_alloc_zeroed_page()};
+
+                if (page == nullptr) {
+                    return false;
+                }
+
+                free_table (&pool, page);
+            }
+
+            return true;
+        }
+
+        // Return all pages in the pool to the page allocator.
+        void release(Page_pool &pool)
+        {
+            while (pool.size_ > 0) {
+                page_alloc_.free_page (alloc_table (&pool));
+            }
         }
 
         // Creates mappings in the page table. Returns true, if a TLB shootdown
         // is necessary.
-        NOINLINE void update(DEFERRED_CLEANUP &cleanup, Mapping const &map)
+        //
+        // New page tables are taken from the pool, which should hold at least
+        // max_new_tables(map) pages. If no pool is given or it runs empty,
+        // page tables are allocated on demand.
+        NOINLINE void update(DEFERRED_CLEANUP &cleanup, Mapping const &map, Page_pool *pool = nullptr)
         {
             assert_slow (root_ != nullptr);
             assert_slow (map.order >= PAGE_BITS and map.order <= max_order());
@@ -440,22 +1034,24 @@ class Generic_page_table
 
             // We have to modify one or more entries in this level and below.
             level_t modified_level {(map.order - PAGE_BITS) / BITS_PER_LEVEL};
-            assert_slow (modified_level < max_levels_);
+            assert_slow (modified_level < max_levels());
 
             // Walk down the page table to find the relevant page table to
             // modify. If we encounter superpages on the way, split
             // them. Missing structures are only created, if we actually have
             // something to map.
             bool const do_create {map.present()};
-            pte_pointer_t const table {walk_down_and_split (cleanup, map.vaddr,
-                                                            modified_level, do_create)};
+            pte_pointer_t const table {walk_down_and_split (cleanup, pool, map.vaddr, modified_level,
+                                                            root_, max_levels() - 1, do_create)};
 
             // We skip filling in new entries when walk_down_and_split has
             // already finished the job. This happens when we remove mappings
             // and the walk down step did not found page tables to recurse into.
             if (table != nullptr) {
-                fill_entries (cleanup, table, modified_level, map);
+                fill_entries (cleanup, pool, table, modified_level, map);
             }
+
+            flush_cache_pending (cleanup);
         }
 
         // Convenience version of the above method when batching of TLB
@@ -469,6 +1065,27 @@ class Generic_page_table
             return cleanup;
         }
 
+        // Downgrade the rights of all mappings in [vaddr, vaddr + 2^order)
+        // without unmapping them.
+        //
+        // The downgrade function is called with the attributes of each
+        // present leaf entry and returns its new attributes. It must not grant
+        // additional rights and must leave the entry present. Mappings that
+        // are completely covered keep their size. Only superpages that
+        // straddle the boundaries of the region are split.
+        template <typename FN>
+        void protect(DEFERRED_CLEANUP &cleanup, virt_t vaddr, ord_t order, FN const &downgrade)
+        {
+            assert_slow (root_ != nullptr);
+            assert_slow (order >= PAGE_BITS and order <= max_order());
+            assert_slow ((vaddr & ((static_cast<virt_t>(1) << order) - 1)) == 0);
+
+            protect_entries (cleanup, root_, max_levels() - 1, 0, vaddr,
+                             vaddr + ((static_cast<virt_t>(1) << order) - 1), downgrade);
+
+            flush_cache_pending (cleanup);
+        }
+
         // Replace a single non-existing or read-only page at the lowest page
         // table level with a new mapping.
         //
@@ -485,7 +1102,7 @@ class Generic_page_table
             assert((paddr & ATTR::mask) == 0);
             assert((attr & ~ATTR::mask) == 0 and (attr & ATTR::PTE_P));
 
-            pte_pointer_t const table {walk_down_and_split (cleanup, vaddr, 0, true)};
+            pte_pointer_t const table {walk_down_and_split (cleanup, nullptr, vaddr, 0, root_, max_levels() - 1, true)};
             assert(table != nullptr);
 
             pte_pointer_t const pte_p {table + virt_to_index(0, vaddr)};
@@ -501,9 +1118,10 @@ class Generic_page_table
                 old_pte = new_pte;
             }
 
-            flush_cache_entries (pte_p, 1);
+            flush_cache_entries (cleanup, pte_p, 1);
+            flush_cache_pending (cleanup);
 
-            return old_pte & ~ATTR::mask;
+            return entry_to_phys(old_pte);
         }
 
         // Prevent copying, but allow moving the page tables around.
@@ -512,9 +1130,10 @@ class Generic_page_table
 
         Generic_page_table(this_t &&rhs)
             : memory_ {rhs.memory_}, page_alloc_ {rhs.page_alloc_}, max_levels_ {rhs.max_levels_},
-              leaf_levels_ {rhs.leaf_levels_}, root_ {rhs.root_}
+              leaf_levels_ {rhs.leaf_levels_}, root_ {rhs.root_}, table_pages_ {rhs.table_pages_}
         {
             rhs.root_ = nullptr;
+            rhs.table_pages_ = 0;
         }
 
         // Create a new page table with a pre-existing root page table pointer.
@@ -522,6 +1141,7 @@ class Generic_page_table
             : memory_ {memory}, max_levels_ {max_levels},
               leaf_levels_ {leaf_levels}, root_ {root}
         {
+            assert (LEVELS == 0 or max_levels_ == LEVELS);
             assert (leaf_levels_ > 0 and leaf_levels_ <= max_levels_);
             assert (max_levels_ > 0 and static_cast<ord_t>(sizeof (virt_t) * 8) >= max_order());
         }
@@ -531,6 +1151,7 @@ class Generic_page_table
             : Generic_page_table (max_levels, leaf_levels, {}, {})
         {
             root_ = page_alloc_.alloc_zeroed_page();
+            table_pages_ = 1;
             flush_cache_page (root_);
         }
 
@@ -543,7 +1164,7 @@ class Generic_page_table
             }
 
             DEFERRED_CLEANUP cleanup_state;
-            cleanup_table(cleanup_state, root_, max_levels_);
+            cleanup_table(cleanup_state, root_, max_levels(), 0);
 
             cleanup_state.ignore_tlb_flush();
             cleanup_state.free_pages_now();
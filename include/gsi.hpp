@@ -48,6 +48,11 @@ class Gsi
 
         static uint64 set (unsigned, unsigned = 0, unsigned = 0);
 
+        // Returns true, if device interrupts can be routed to the CPU. I/O
+        // APIC entries, MSIs and interrupt remapping entries use the xAPIC
+        // destination format, which only holds APIC IDs below 256.
+        static bool can_target (unsigned cpu);
+
         static void mask (unsigned);
         static void unmask (unsigned);
 
@@ -20,11 +20,12 @@
 #include "generic_page_table.hpp"
 #include "page_alloc_policy.hpp"
 #include "page_table_policies.hpp"
+#include "remap_slots.hpp"
 #include "tlb_cleanup.hpp"
 
 class Hpt;
 using Hpt_page_table = Generic_page_table<9, mword, Atomic_access_policy<>, No_clflush_policy,
-                                          Page_alloc_policy<>, Tlb_cleanup, Hpt>;
+                                          Page_alloc_policy<>, Tlb_cleanup, Hpt, 4>;
 
 // Host Page Table
 //
@@ -38,12 +39,6 @@ class Hpt : public Hpt_page_table
         // The number of leaf levels we support.
         static level_t supported_leaf_levels;
 
-        static void flush()
-        {
-            mword cr3;
-            asm volatile ("mov %%cr3, %0; mov %0, %%cr3" : "=&r" (cr3));
-        }
-
         using Hpt_page_table::Hpt_page_table;
 
     public:
@@ -66,6 +61,14 @@ class Hpt : public Hpt_page_table
             PTE_S  = 1ULL << 7,
             PTE_G  = 1ULL << 8,
 
+            // Marks page table entries that point to page tables owned by
+            // another page table. See Generic_page_table::link_from.
+            PTE_L  = 1ULL << 9,
+
+            // Marks read-only leaf entries that are copied when they are
+            // written to. See Space_mem::resolve_cow.
+            PTE_COW = 1ULL << 10,
+
             PTE_A  = 1ULL << 5,
             PTE_D  = 1ULL << 6,
 
@@ -90,14 +93,18 @@ class Hpt : public Hpt_page_table
         };
 
         static constexpr pte_t all_rights {PTE_P | PTE_W | PTE_U | PTE_A | PTE_D};
-        static constexpr pte_t mask {PTE_NX | PTE_MT_MASK | PTE_NODELEG | PTE_UC | PTE_G | all_rights};
+        static constexpr pte_t mask {PTE_NX | PTE_MT_MASK | PTE_NODELEG | PTE_UC | PTE_G | PTE_COW | all_rights};
 
         // Adjust the number of leaf levels to the given value.
         static void set_supported_leaf_levels(level_t level);
 
-        // Return a structural copy of this page table for the given virtual
-        // address range.
-        Hpt deep_copy(mword vaddr_start, mword vaddr_end);
+        // Return a new page table that shares the page table structures of
+        // this page table for the given virtual address range.
+        //
+        // Sharing happens at 1 GiB granularity, so the start of the range is
+        // rounded down and its end needs to be 1 GiB aligned. Any later change
+        // to the shared range is visible in both page tables.
+        Hpt shallow_copy(mword vaddr_start, mword vaddr_end);
 
         void make_current (mword pcid)
         {
@@ -109,21 +116,65 @@ class Hpt : public Hpt_page_table
             asm volatile ("mov %0, %%cr3" : : "r" (phys_root | pcid) : "memory");
         }
 
+        // Flush the non-global TLB entries of the current address space.
+        static void flush()
+        {
+            mword cr3;
+            asm volatile ("mov %%cr3, %0; mov %0, %%cr3" : "=&r" (cr3));
+        }
+
+        // Invalidate the TLB entries of the page that contains vaddr in the
+        // current address space.
+        static void invalidate (mword vaddr)
+        {
+            asm volatile ("invlpg %0" : : "m" (*reinterpret_cast<char *>(vaddr)) : "memory");
+        }
+
         // The limit of how much memory can be accessed safely after remap().
         static const size_t remap_guaranteed_size;
 
+        // A temporary mapping of physical memory (see remap).
+        //
+        // The mapping stays valid as long as this object exists and is only
+        // valid on the CPU that created it.
+        class Remapping
+        {
+            private:
+                Remap_slots &slots_;
+                unsigned const slot_;
+                mword const addr_;
+
+            public:
+                template <typename T = void>
+                T *get() const { return reinterpret_cast<T *>(addr_); }
+
+                Remapping(Remap_slots &slots, unsigned slot, mword addr) : slots_ {slots}, slot_ {slot}, addr_ {addr} {}
+                ~Remapping() { slots_.release (slot_); }
+
+                Remapping(Remapping const &) = delete;
+                Remapping &operator=(Remapping const &) = delete;
+        };
+
         // Temporarily map the given physical memory.
         //
         // Establish a temporary mapping for the given physical address in a
         // special kernel virtual address region reserved for this
-        // usecase. Return a pointer to access this memory. phys does not need
-        // to be aligned.
+        // usecase. The mapping is visible in all kernel address spaces. phys
+        // does not need to be aligned.
         //
-        // If use_boot_hpt is true, the mapping is established in the boot page
-        // tables. If not, use the current Pd's kernel address space.
+        // Each CPU has a few windows for temporary mappings. Mappings that are
+        // still present are reused. Replacing a mapping only invalidates its
+        // TLB entries on this CPU.
         //
-        // The returned pointer is valid until the next remap call (on any core).
-        static void *remap (Paddr phys, bool use_boot_hpt = true);
+        // Running out of windows is fatal. Code that holds more than one
+        // mapping at a time asserts that enough windows are free (see
+        // remap_available) and must not call into code that takes further
+        // mappings while it holds them.
+        WARN_UNUSED_RESULT static Remapping remap (Paddr phys);
+
+        // Returns the number of windows of the current CPU that are not in
+        // use by a Remapping.
+        static unsigned remap_available();
 
         // Atomically change a 4K page mapping to point to a new frame. Return
         // the physical address that backs vaddr.
@@ -135,12 +186,6 @@ class Hpt : public Hpt_page_table
         // Create a page table from scratch.
         Hpt() : Hpt_page_table(4, supported_leaf_levels) {}
 
-        // Create the page table that is (ab)used as physical memory
-        // database. This is never actually used as a page table by the CPU, so
-        // we can pretend to have really large pages to save valuable kernel
-        // memory.
-        static Hpt make_golden_hpt() { return Hpt (4, 4); }
-
         // Convert mapping database attributes to page table attributes.
         static pte_t hw_attr(mword a);
 
@@ -159,5 +204,11 @@ class Hpt : public Hpt_page_table
         }
 
         // The boot page table as constructed in start.S.
+        //
+        // Every other host page table links the page tables of the kernel
+        // range of the boot page table (see shallow_copy). Changes to this
+        // range are visible in all address spaces at once, but nothing shoots
+        // down the TLBs of other CPUs. They must only change mappings that
+        // are accessed by the current CPU, like the windows of remap().
         static Hpt &boot_hpt();
 };
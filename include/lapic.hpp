@@ -24,6 +24,7 @@
 #pragma once
 
 #include "compiler.hpp"
+#include "cpuset.hpp"
 #include "memory.hpp"
 #include "msr.hpp"
 #include "x86.hpp"
@@ -68,20 +69,39 @@ class Lapic
             DLV_EXTINT      = 7U << 8,
         };
 
+        enum Destination_mode
+        {
+            DST_PHYSICAL    = 0U << 11,
+            DST_LOGICAL     = 1U << 11,
+        };
+
         enum Shorthand
         {
             DSH_NONE        = 0U << 18,
             DSH_EXC_SELF    = 3U << 18,
         };
 
+        // In x2APIC mode, the registers are accessed via MSRs instead of
+        // the memory-mapped page.
         static inline uint32 read (Register reg)
         {
+            if (x2apic)
+                return static_cast<uint32>(Msr::read (x2apic_msr (reg)));
+
             return *reinterpret_cast<uint32 volatile *>(CPU_LOCAL_APIC + (reg << 4));
         }
 
         static inline void write (Register reg, uint32 val)
         {
-            *reinterpret_cast<uint32 volatile *>(CPU_LOCAL_APIC + (reg << 4)) = val;
+            if (x2apic)
+                Msr::write (x2apic_msr (reg), val);
+            else
+                *reinterpret_cast<uint32 volatile *>(CPU_LOCAL_APIC + (reg << 4)) = val;
+        }
+
+        static inline Msr::Register x2apic_msr (Register reg)
+        {
+            return static_cast<Msr::Register>(Msr::IA32_EXT_XAPIC + reg);
         }
 
         static inline void set_lvt (Register reg, Delivery_mode dlv, unsigned vector, unsigned misc = 0)
@@ -89,6 +109,10 @@ class Lapic
             write (reg, misc | dlv | vector);
         }
 
+        // Write the interrupt command register. The destination is an APIC ID
+        // or a logical destination depending on the destination mode in icr.
+        static void write_icr (uint32 dst, uint32 icr);
+
         static inline void timer_handler();
 
         static inline void error_handler();
@@ -104,6 +128,10 @@ class Lapic
         static unsigned freq_bus;
         static bool     use_tsc_timer;
 
+        // Whether the local APIC runs in x2APIC mode. This is the same on
+        // all CPUs.
+        static bool     x2apic;
+
         // Number of CPUs that still need to be parked.
         //
         // See park_all_but_self.
@@ -118,14 +146,25 @@ class Lapic
 
         static inline unsigned id()
         {
-            return read (LAPIC_IDR) >> 24 & 0xff;
+            return x2apic ? read (LAPIC_IDR) : read (LAPIC_IDR) >> 24 & 0xff;
         }
 
         // This is a special version of id() that already works when the LAPIC
         // is not mapped yet.
         static inline unsigned early_id()
         {
-            uint32 ebx, dummy;
+            uint32 eax, ebx, edx, dummy;
+
+            // The extended topology leaf reports the full 32-bit x2APIC ID.
+            // For APIC IDs below 255, it matches the xAPIC ID.
+            cpuid (0, eax, dummy, dummy, dummy);
+
+            if (eax >= 0xb) {
+                cpuid (0xb, 0, dummy, ebx, dummy, edx);
+
+                if (ebx != 0)
+                    return edx;
+            }
 
             cpuid (1, dummy, ebx, dummy, dummy);
 
@@ -183,6 +222,14 @@ class Lapic
 
         static void send_ipi (unsigned, unsigned, Delivery_mode = DLV_FIXED, Shorthand = DSH_NONE);
 
+        // Send a fixed IPI to all CPUs in the set, which must not contain the
+        // current CPU.
+        //
+        // This uses as few ICR writes as possible. If the set covers nearly
+        // all other CPUs, the IPI is broadcast to all of them. The handler of
+        // the vector must therefore tolerate spurious invocations.
+        static void send_ipi (Cpuset const &, unsigned);
+
         // Stop all CPUs except the current one.
         //
         // Parked CPUs execute the passed function and all but the calling CPU
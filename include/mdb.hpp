@@ -20,20 +20,16 @@
 
 #pragma once
 
-#include "avl.hpp"
 #include "math.hpp"
 #include "rcu_list.hpp"
 #include "slab.hpp"
 
 class Space;
 
-class Mdb : public Avl, public Rcu_elem
+class Mdb : public Rcu_elem
 {
     private:
         static Slab_cache   cache;
-        static Spinlock     lock;
-
-        bool alive() const { return prev->next == this && next->prev == this; }
 
         static void free (Rcu_elem *e)
         {
@@ -42,18 +38,25 @@ class Mdb : public Avl, public Rcu_elem
         }
 
     public:
-        Spinlock        node_lock;
+        // The fields that traversals read come first. Small fields are
+        // packed into one word, but each one stays a separate memory
+        // location, because tree_lock is updated atomically and node_attr is
+        // read without the lock.
+
+        // Serializes all changes to the derivation tree and the updates of
+        // its capabilities, if this is its root (see Derivation_tree).
+        Spinlock        tree_lock;
         uint16          dpth;
+        uint8     const node_order;
+        uint8           node_attr;
+        uint8     const node_type;
+        uint8     const node_sub;
         Mdb *           prev;
         Mdb *           next;
         Mdb *           prnt;
-        Space *   const space;
-        mword     const node_phys;
         mword     const node_base;
-        mword     const node_order;
-        mword           node_attr;
-        mword     const node_type;
-        mword     const node_sub;
+        mword     const node_phys;
+        Space *   const space;
 
         enum Mdb_mem_attr {
             MEM_R = 1U << 0,
@@ -61,32 +64,14 @@ class Mdb : public Avl, public Rcu_elem
             MEM_X = 1U << 2,
         };
 
-        inline bool larger (Mdb *x) const { return  node_base > x->node_base; }
-
-        inline bool equal  (Mdb *x) const { return (node_base ^ x->node_base) >> max (node_order, x->node_order) == 0; }
-
         NOINLINE
-        explicit Mdb (Space *s, mword p, mword b, mword a, void (*f)(Rcu_elem *), void (*pf)(Rcu_elem *) = nullptr) : Rcu_elem (f, pf), dpth (0), prev (this), next (this), prnt (nullptr), space (s), node_phys (p), node_base (b), node_order (0), node_attr (a), node_type (0), node_sub (0) {}
+        explicit Mdb (Space *s, mword p, mword b, mword a, void (*f)(Rcu_elem *), void (*pf)(Rcu_elem *) = nullptr) : Rcu_elem (f, pf), dpth (0), node_order (0), node_attr (static_cast<uint8>(a)), node_type (0), node_sub (0), prev (this), next (this), prnt (nullptr), node_base (b), node_phys (p), space (s) {}
 
         NOINLINE
-        explicit Mdb (Space *s, mword p, mword b, mword o = 0, mword a = 0, mword t = 0, mword sub = 0) : Rcu_elem (free), dpth (0), prev (this), next (this), prnt (nullptr), space (s), node_phys (p), node_base (b), node_order (o), node_attr (a), node_type (t), node_sub (sub) {}
+        explicit Mdb (Space *s, mword p, mword b, mword o = 0, mword a = 0, mword t = 0, mword sub = 0) : Rcu_elem (free), dpth (0), node_order (static_cast<uint8>(o)), node_attr (static_cast<uint8>(a)), node_type (static_cast<uint8>(t)), node_sub (static_cast<uint8>(sub)), prev (this), next (this), prnt (nullptr), node_base (b), node_phys (p), space (s) {}
 
-        static Mdb *lookup (Avl *tree, mword base, bool next)
-        {
-            Mdb *n = nullptr;
-            bool d;
-
-            for (Mdb *m = static_cast<Mdb *>(tree); m; m = static_cast<Mdb *>(m->lnk[d])) {
-
-                if ((m->node_base ^ base) >> m->node_order == 0)
-                    return m;
-
-                if ((d = base > m->node_base) == 0 && next)
-                    n = m;
-            }
-
-            return n;
-        }
+        // The lock of the derivation tree of this node.
+        Spinlock &derivation_lock();
 
         bool insert_node (Mdb *, mword);
         void demote_node (mword);
@@ -0,0 +1,67 @@
+/*
+ * In-place downgrade of memory rights
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "types.hpp"
+
+// Remove write and/or execute rights from the mappings of all subspaces of a
+// memory space without unmapping them (see Space_mem::revoke).
+//
+// Guest memory is translated either by an HPT-format npt or by an ept. Device
+// memory is translated by a dpt, unless DMA uses the ept. Page tables that
+// are not used are passed as nullptr. Device mappings are never executable.
+//
+// If cow is true, the host and guest mappings in the region are marked as
+// copy-on-write (see Space_mem::resolve_cow). Devices can't fault, so their
+// mappings are only write-protected.
+template <typename HPT, typename EPT, typename DPT, typename CLEANUP>
+void protect_subspaces (CLEANUP &cleanup, mword vaddr, typename HPT::ord_t order, bool no_w, bool no_x, bool cow,
+                        HPT &hpt, HPT *npt, EPT *ept, DPT *dpt)
+{
+    using hpt_pte  = typename HPT::pte_t;
+    using ept_pte  = typename EPT::pte_t;
+    using dpt_pte  = typename DPT::pte_t;
+    using hpt_attr = typename HPT::attr_t;
+    using ept_attr = typename EPT::attr_t;
+    using dpt_attr = typename DPT::attr_t;
+
+    hpt_pte const hpt_clear {no_w ? static_cast<hpt_pte>(hpt_attr::PTE_W)   : 0};
+    hpt_pte const hpt_set   {no_x ? static_cast<hpt_pte>(hpt_attr::PTE_NX)  : 0};
+    hpt_pte const hpt_cow   {cow  ? static_cast<hpt_pte>(hpt_attr::PTE_COW) : 0};
+    ept_pte const ept_clear {(no_w ? static_cast<ept_pte>(ept_attr::PTE_W) : 0) |
+                             (no_x ? static_cast<ept_pte>(ept_attr::PTE_X) : 0)};
+    ept_pte const ept_cow   {cow  ? static_cast<ept_pte>(ept_attr::PTE_COW) : 0};
+
+    auto const protect_hpt {[hpt_clear, hpt_set] (hpt_pte a) { return (a & ~hpt_clear) | hpt_set; }};
+
+    auto const mark_hpt {[&protect_hpt, hpt_cow] (hpt_pte a) { return protect_hpt (a) | hpt_cow; }};
+
+    hpt.protect (cleanup, vaddr, order, mark_hpt);
+
+    if (npt) {
+        npt->protect (cleanup, vaddr, order, mark_hpt);
+    }
+
+    if (ept) {
+        ept->protect (cleanup, vaddr, order, [ept_clear, ept_cow] (ept_pte a) { return (a & ~ept_clear) | ept_cow; });
+    }
+
+    if (dpt and no_w) {
+        dpt->protect (cleanup, vaddr, order, [] (dpt_pte a) { return a & ~static_cast<dpt_pte>(dpt_attr::PTE_W); });
+    }
+}
@@ -27,7 +27,6 @@
 //
 // 0xffff_ffff_ffff_ffff END_SPACE_LIM - 1
 // 0xffff_ffff_e000_0000 SPC_LOCAL_OBJ
-// 0xffff_ffff_df00_0000 SPC_LOCAL_REMAP
 
 // 0xffff_ffff_c000_2000 SPC_LOCAL_IOP_E
 // 0xffff_ffff_c000_0000 SPC_LOCAL / SPC_LOCAL_IOP
@@ -38,6 +37,9 @@
 
 // 0xffff_ffff_8800_0000 LINK_ADDR
 
+// 0xffff_ffff_4000_0000 CPU_REMAP
+// 0xffff_ffff_3f00_0000 BOOT_REMAP
+
 #define PAGE_BITS       12
 #define PAGE_SIZE       (1 << PAGE_BITS)
 #define PAGE_MASK       (PAGE_SIZE - 1)
@@ -63,6 +65,10 @@ static_assert(LOAD_ADDR % LOAD_ADDR_ALIGN == 0, "Link-time alignment is broken")
 #define CANON_BOUND     0x0000800000000000
 #define USER_ADDR       0x00007ffffffff000
 #define LINK_ADDR       0xffffffff88000000
+#define CPU_REMAP       0xffffffff40000000
+#define CPU_REMAP_E     0xffffffff80000000
+#define BOOT_REMAP      0xffffffff3f000000
+#define BOOT_REMAP_E    (CPU_REMAP)
 #define CPU_LOCAL       0xffffffffbfe00000
 #define SPC_LOCAL       0xffffffffc0000000
 
@@ -75,7 +81,6 @@ static_assert(LOAD_ADDR % LOAD_ADDR_ALIGN == 0, "Link-time alignment is broken")
 
 #define SPC_LOCAL_IOP   (SPC_LOCAL)
 #define SPC_LOCAL_IOP_E (SPC_LOCAL_IOP + PAGE_SIZE * 2)
-#define SPC_LOCAL_REMAP (SPC_LOCAL_OBJ - 0x1000000)
 #define SPC_LOCAL_OBJ   (END_SPACE_LIM - 0x20000000)
 
 #define END_SPACE_LIM   (~0UL + 1)
@@ -32,6 +32,11 @@ class Page_alloc_policy
         static entry   pointer_to_phys (pointer p)    { return Buddy::ptr_to_phys (p); }
 
         static pointer alloc_zeroed_page()            { return static_cast<pointer>(Buddy::allocator.alloc (0, Buddy::FILL_0)); }
+        static pointer try_alloc_zeroed_page()        { return static_cast<pointer>(Buddy::allocator.try_alloc (0, Buddy::FILL_0)); }
         static void    free_page        (pointer ptr) { Buddy::allocator.free (reinterpret_cast<mword>(ptr)); }
+
+        static void    ref_page         (pointer ptr) { Buddy::allocator.ref (reinterpret_cast<mword>(ptr)); }
+        static bool    unref_page       (pointer ptr) { return Buddy::allocator.unref (reinterpret_cast<mword>(ptr)); }
+        static bool    is_shared_page   (pointer ptr) { return Buddy::allocator.shared (reinterpret_cast<mword>(ptr)); }
 };
 
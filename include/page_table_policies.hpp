@@ -19,6 +19,8 @@
 
 #include "atomic.hpp"
 #include "buddy.hpp"
+#include "counter.hpp"
+#include "cpu.hpp"
 #include "types.hpp"
 #include "x86.hpp"
 
@@ -39,6 +41,9 @@ class Atomic_access_policy
 class No_clflush_policy
 {
     public:
+        // Page table memory is coherent with all page table walkers.
+        static constexpr bool noncoherent {false};
+
         static void clflush ([[maybe_unused]] void *p, [[maybe_unused]] size_t n) {}
 
 };
@@ -46,5 +51,41 @@ class No_clflush_policy
 class Clflush_policy
 {
     public:
-        static void clflush (void *p, size_t n) { ::clflush(p, n); }
+        // Page table walkers do not snoop caches. Modified page table memory
+        // has to be written back before the walker can see it.
+        static constexpr bool noncoherent {true};
+
+        // The granularity of cache flushes. All x86_64 CPUs use 64-byte cache
+        // lines.
+        static constexpr size_t line_size {64};
+
+        // Write back a memory range and return the number of cache lines
+        // that were flushed. The flushes are only guaranteed to be complete
+        // after a call to fence().
+        static size_t clflush (void *p, size_t n)
+        {
+            char *const start {static_cast<char *>(p) - reinterpret_cast<mword>(p) % line_size};
+            char *const end   {static_cast<char *>(p) + n};
+
+            bool const has_clwb       {Cpu::feature (Cpu::FEAT_CLWB)};
+            bool const has_clflushopt {Cpu::feature (Cpu::FEAT_CLFLUSHOPT)};
+
+            size_t lines {0};
+
+            for (char *l {start}; l < end; l += line_size, lines++) {
+                if (has_clwb) {
+                    ::clwb (l);
+                } else if (has_clflushopt) {
+                    ::clflushopt (l);
+                } else {
+                    ::clflush (l);
+                }
+            }
+
+            Counter::cache_flush() += lines;
+            return lines;
+        }
+
+        // Wait for all previous cache flushes to complete.
+        static void fence() { sfence(); }
 };
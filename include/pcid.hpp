@@ -0,0 +1,99 @@
+/*
+ * Process-context identifier (PCID) assignment
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "types.hpp"
+
+// The PCIDs of one CPU.
+//
+// Each CPU keeps the TLB entries of the memory spaces it used most recently in
+// a small number of PCID slots. A memory space is identified by its
+// generation, which is never reused. A slot that is handed to another memory
+// space may still hold translations of its former owner, so it has to be
+// flushed once. The former owner is reported back, because it does not have
+// any TLB entries on this CPU anymore afterwards.
+//
+// PCID 0 is never assigned and is left to the kernel page table.
+template <typename OWNER>
+class Pcid
+{
+    public:
+        static constexpr unsigned NUM_SLOTS {8};
+
+    private:
+        // The generation of the memory space that owns each slot. Generation
+        // zero marks a free slot.
+        uint64 generation_[NUM_SLOTS] {};
+        OWNER *owner_[NUM_SLOTS] {};
+
+        // The value of clock_ when each slot was last used.
+        uint64 last_used_[NUM_SLOTS] {};
+        uint64 clock_ {0};
+
+    public:
+        // Return the PCID of the given memory space. If the PCID had to be
+        // taken from another memory space, fresh is true and the TLB entries
+        // of the PCID have to be flushed. evicted is then the former owner or
+        // nullptr for a free slot.
+        unsigned assign(OWNER *owner, uint64 generation, bool &fresh, OWNER *&evicted)
+        {
+            unsigned lru {0};
+
+            clock_++;
+
+            for (unsigned i {0}; i < NUM_SLOTS; i++) {
+                if (generation_[i] == generation) {
+                    last_used_[i] = clock_;
+                    fresh   = false;
+                    evicted = nullptr;
+                    return i + 1;
+                }
+
+                if (last_used_[i] < last_used_[lru]) {
+                    lru = i;
+                }
+            }
+
+            evicted = owner_[lru];
+            fresh   = true;
+
+            generation_[lru] = generation;
+            owner_[lru]      = owner;
+            last_used_[lru]  = clock_;
+
+            return lru + 1;
+        }
+
+        // Free a slot whose owner satisfies pred and return the owner. The
+        // TLB entries of the slot are flushed when it is assigned again.
+        // Returns nullptr, if there is no such slot.
+        template <typename PRED>
+        OWNER *release(PRED pred)
+        {
+            for (unsigned i {0}; i < NUM_SLOTS; i++) {
+                if (OWNER *const owner {owner_[i]}; owner and pred (owner)) {
+                    generation_[i] = 0;
+                    owner_[i]      = nullptr;
+                    last_used_[i]  = 0;
+                    return owner;
+                }
+            }
+
+            return nullptr;
+        }
+};
@@ -40,6 +40,10 @@ class Pd : public Typed_kobject<Kobject::Type::PD>, public Refcount, public Spac
 
         void *apic_access_page {nullptr};
 
+        // The number of PCID slots of all CPUs that hold a reference to this
+        // PD (see release_pcids).
+        uint32 pcid_refs {0};
+
         static void pre_free (Rcu_elem * a)
         {
             Pd * pd = static_cast <Pd *>(a);
@@ -62,6 +66,7 @@ class Pd : public Typed_kobject<Kobject::Type::PD>, public Refcount, public Spac
 
     public:
         CPULOCAL_REMOTE_ACCESSOR(pd, current);
+        CPULOCAL_ACCESSOR(pd, pcids);
         static No_destruct<Pd> kern;
 
         // The roottask is privileged and can map arbitrary physical memory that
@@ -81,6 +86,7 @@ class Pd : public Typed_kobject<Kobject::Type::PD>, public Refcount, public Spac
         enum pd_creation_flags {
             IS_PRIVILEGED = 1 << 0,
             IS_PASSTHROUGH = 1 << 1,
+            IS_DMA_EPT = 1 << 2,
         };
 
         // Construct a protection domain.
@@ -88,35 +94,44 @@ class Pd : public Typed_kobject<Kobject::Type::PD>, public Refcount, public Spac
         // creation_flags is a bit field of pd_creation_flags.
         Pd (Pd *own, mword sel, mword a, int creation_flags);
 
+        // When we schedule the idle EC, we switch to Pd::kern. Pd::kern's
+        // host page table is actually all the physical memory that userspace
+        // can use, so we cannot use it as a page table here.
+        inline Hpt &host_hpt()
+        {
+            return EXPECT_FALSE (this == &Pd::kern) ? Hpt::boot_hpt() : hpt;
+        }
+
+        // Invalidate the stale host TLB entries of this PD on the current CPU
+        // after it became the current PD. If the TLB was flushed by switching
+        // page tables, this only marks them as done.
+        void invalidate_stale_host_tlb (bool tlb_flushed);
+
+        // Switch the current CPU from the previous PD to this one.
+        void switch_from (Pd *old, bool stale);
+
+        // Free the PCID slots of the current CPU whose PD is only referenced
+        // by PCID slots anymore, so they don't keep destroyed PDs alive. Only
+        // called with Pd::kern as the current PD.
+        static void release_pcids();
+
         HOT
         inline void make_current()
         {
-            mword pcid = did;
+            bool const stale {stale_host_tlb.chk (Cpu::id())};
 
-            if (EXPECT_FALSE (stale_host_tlb.chk (Cpu::id())))
+            if (EXPECT_FALSE (stale))
                 stale_host_tlb.clr (Cpu::id());
 
-            else {
+            if (EXPECT_TRUE (current() == this)) {
 
-                if (EXPECT_TRUE (current() == this))
-                    return;
+                if (EXPECT_FALSE (stale))
+                    invalidate_stale_host_tlb (false);
 
-                pcid |= static_cast<mword>(1ULL << 63);
+                return;
             }
 
-            if (current()->del_rcu())
-                Rcu::call (current());
-
-            current() = this;
-
-            bool ok = current()->add_ref();
-            assert (ok);
-
-            // When we schedule the idle EC, we switch to Pd::kern. Pd::kern's
-            // host page table is actually all the physical memory that
-            // userspace can use, so we cannot use it as a page table here.
-            Hpt &target_hpt {EXPECT_FALSE (this == &Pd::kern) ? Hpt::boot_hpt() : hpt};
-            target_hpt.make_current (Cpu::feature (Cpu::FEAT_PCID) ? pcid : 0);
+            switch_from (current(), stale);
         }
 
         // Access the current PD on a remote core.
@@ -145,11 +160,28 @@ class Pd : public Typed_kobject<Kobject::Type::PD>, public Refcount, public Spac
         template <typename>
         void revoke (mword, mword, mword, bool);
 
-        Xfer xfer_item  (Pd *, Crd, Crd, Xfer);
+        // Invalidate the TLB entries that were recorded in cleanup on all
+        // CPUs.
+        static void tlb_shootdown (Tlb_cleanup &cleanup)
+        {
+            if (cleanup.need_tlb_flush()) {
+                shootdown();
+                cleanup.tlb_flush_done();
+            }
+        }
+
+        // Transfer a typed item. TLB entries that became stale are recorded
+        // in the cleanup object, so transfers can share a single shootdown
+        // (see tlb_shootdown). If a delegation runs out of memory, the
+        // returned item is empty and out_of_memory is set, if given.
+        Xfer xfer_item  (Pd *, Crd, Crd, Xfer, Tlb_cleanup &, bool *out_of_memory = nullptr);
         void xfer_items (Pd *, Crd, Crd, Xfer *, Xfer *, unsigned long);
 
         void xlt_crd (Pd *, Crd, Crd &);
-        void del_crd (Pd *, Crd, Crd &, mword = 0, mword = 0);
+
+        // Returns false, if a memory delegation ran out of memory.
+        bool del_crd (Pd *, Crd, Crd &, Tlb_cleanup &, mword = 0, mword = 0, bool = false, bool = false);
+        void don_crd (Pd *, Crd, Crd &, Tlb_cleanup &, mword);
         void rev_crd (Crd, bool);
 
         static inline void *operator new (size_t) { return cache.alloc(); }
@@ -0,0 +1,403 @@
+/*
+ * Radix tree of naturally aligned ranges
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "assert.hpp"
+#include "atomic.hpp"
+#include "types.hpp"
+
+// An index of non-overlapping ranges of keys.
+//
+// Each entry covers the keys [node_base, node_base + 2^node_order), where
+// node_base is a multiple of 2^node_order. Entries are stored in the level
+// whose slots cover at most 2^node_order keys, so an entry may occupy several
+// consecutive slots of one node. The height of the tree grows with the
+// largest key, so small keys take few levels.
+//
+// Lookups may run concurrently with changes. They see valid nodes and entries
+// that were in the tree at some point during the lookup, but may return
+// inconsistent results. Callers have to detect concurrent changes and repeat
+// such lookups (see Space::tree_lookup). Nodes that become empty are unlinked
+// and handed to free_deferred(), which must keep them valid until all lookups
+// that may have seen them have finished.
+//
+// Nodes are allocated by NODE_ALLOC, which provides alloc() for zeroed memory
+// of sizeof (Node), free() and free_deferred().
+template <typename ENTRY, typename NODE_ALLOC>
+class Radix_tree
+{
+    public:
+        static constexpr unsigned BITS_PER_LEVEL {6};
+        static constexpr unsigned FANOUT         {1U << BITS_PER_LEVEL};
+        static constexpr unsigned MAX_LEVELS     {(sizeof (mword) * 8 + BITS_PER_LEVEL - 1) / BITS_PER_LEVEL};
+
+        struct Node
+        {
+            // Each slot is empty, holds an entry or a child node with the
+            // lowest bit set.
+            mword    slot[FANOUT];
+
+            // The number of non-empty slots.
+            unsigned used;
+
+            // The parent in the tree.
+            Node *   parent;
+        };
+
+        // A position in the tree that allows to visit entries in order
+        // without descending from the root for each one. A cursor is only
+        // valid as long as the tree does not change.
+        class Cursor
+        {
+            friend class Radix_tree;
+
+            private:
+                // The node and level of the last entry.
+                Node *   node_  {nullptr};
+                unsigned level_ {0};
+                unsigned height_ {0};
+
+                // The first key of the last entry.
+                mword    last_  {0};
+
+                // The first key that was not visited yet.
+                mword    key_;
+                bool     end_   {false};
+
+            public:
+                explicit Cursor (mword key) : key_ (key) {}
+
+                // The first key that the cursor did not visit yet.
+                mword key() const { return key_; }
+
+                // Returns true, if there are no more entries.
+                bool end() const { return end_; }
+        };
+
+    private:
+        NODE_ALLOC alloc_;
+
+        Node *     root_   {nullptr};
+        unsigned   height_ {0};
+
+        static bool is_node (mword s) { return s & 1; }
+
+        static Node  *to_node (mword s)  { return reinterpret_cast<Node *>(s & ~static_cast<mword>(1)); }
+        static ENTRY *to_entry (mword s) { return reinterpret_cast<ENTRY *>(s); }
+
+        static mword from_node (Node *n)   { return reinterpret_cast<mword>(n) | 1; }
+        static mword from_entry (ENTRY *e) { return reinterpret_cast<mword>(e); }
+
+        static unsigned index (mword key, unsigned level)
+        {
+            return static_cast<unsigned>(key >> (level * BITS_PER_LEVEL)) % FANOUT;
+        }
+
+        // Returns true, if key is below the keys covered by a tree of the
+        // given height.
+        static bool fits (mword key, unsigned height)
+        {
+            return height * BITS_PER_LEVEL >= sizeof (mword) * 8 or key >> (height * BITS_PER_LEVEL) == 0;
+        }
+
+        Node *alloc_node()
+        {
+            return static_cast<Node *>(alloc_.alloc());
+        }
+
+        void free_subtree (Node *n, unsigned level)
+        {
+            for (mword s : n->slot) {
+                if (level > 0 and is_node (s)) {
+                    free_subtree (to_node (s), level - 1);
+                }
+            }
+
+            alloc_.free (n);
+        }
+
+        // Search the subtree of node n at the given level. If at is not
+        // null, it receives the node that holds the returned entry.
+        static ENTRY *find (Node *n, unsigned level, mword key, bool next, Node **at)
+        {
+            for (unsigned i {index (key, level)}; i < FANOUT; i++) {
+                mword const s {Atomic::load (n->slot[i])};
+
+                if (not s) {
+                    if (not next) {
+                        return nullptr;
+                    }
+
+                    continue;
+                }
+
+                if (not is_node (s)) {
+                    if (at) {
+                        *at = n;
+                    }
+
+                    return to_entry (s);
+                }
+
+                // Only seen during concurrent changes.
+                if (level == 0) {
+                    return nullptr;
+                }
+
+                // Later children only hold larger keys, so their search
+                // starts at their first key.
+                ENTRY *e {find (to_node (s), level - 1, i == index (key, level) ? key : 0, next, at)};
+
+                if (e or not next) {
+                    return e;
+                }
+            }
+
+            return nullptr;
+        }
+
+        // Move the cursor behind entry e.
+        static ENTRY *advance (Cursor &c, ENTRY *e)
+        {
+            if (not e) {
+                c.end_ = true;
+                return nullptr;
+            }
+
+            c.level_ = static_cast<unsigned>(e->node_order / BITS_PER_LEVEL);
+            c.last_  = e->node_base;
+            c.key_   = e->node_base + (static_cast<mword>(1) << e->node_order);
+            c.end_   = c.key_ == 0;
+
+            return e;
+        }
+
+    public:
+        Radix_tree() = default;
+
+        Radix_tree (Radix_tree const &) = delete;
+        Radix_tree &operator= (Radix_tree const &) = delete;
+
+        ~Radix_tree()
+        {
+            if (root_) {
+                free_subtree (root_, height_ - 1);
+            }
+        }
+
+        // Returns the entry that covers key. If there is none and next is
+        // true, returns the entry with the next larger keys instead.
+        ENTRY *lookup (mword key, bool next = false)
+        {
+            Node *const    root   {Atomic::load (root_)};
+            unsigned const height {Atomic::load (height_)};
+
+            if (not root or height == 0 or not fits (key, height)) {
+                return nullptr;
+            }
+
+            return find (root, height - 1, key, next, nullptr);
+        }
+
+        // Returns the entry that covers the key of the cursor or the entry
+        // with the next larger keys and moves the cursor behind it.
+        ENTRY *seek (Cursor &c)
+        {
+            Node *const    root   {Atomic::load (root_)};
+            unsigned const height {Atomic::load (height_)};
+
+            if (c.end_ or not root or height == 0 or not fits (c.key_, height)) {
+                return nullptr;
+            }
+
+            c.height_ = height;
+
+            return advance (c, find (root, height - 1, c.key_, true, &c.node_));
+        }
+
+        // Returns the entry after the one the cursor returned last and moves
+        // the cursor behind it. The tree must not have changed since.
+        ENTRY *next (Cursor &c)
+        {
+            if (c.end_) {
+                return nullptr;
+            }
+
+            Node *n {c.node_};
+
+            for (unsigned l {c.level_}; l < c.height_; l++, n = Atomic::load (n->parent)) {
+                unsigned const shift {(l + 1) * BITS_PER_LEVEL};
+                bool const     top   {shift >= sizeof (mword) * 8};
+
+                // Skip nodes that don't hold the next key.
+                if (not top and c.key_ >> shift != c.last_ >> shift) {
+                    continue;
+                }
+
+                if (ENTRY *e {find (n, l, c.key_, true, &c.node_)}) {
+                    return advance (c, e);
+                }
+
+                // Continue with the first key after this node.
+                if (top or (c.last_ >> shift) + 1 == static_cast<mword>(1) << (sizeof (mword) * 8 - shift)) {
+                    break;
+                }
+
+                c.key_ = ((c.last_ >> shift) + 1) << shift;
+            }
+
+            c.end_ = true;
+            return nullptr;
+        }
+
+        // Adds an entry. Fails, if it overlaps with an existing entry.
+        bool insert (ENTRY *e)
+        {
+            mword const    base  {e->node_base};
+            mword const    order {e->node_order};
+            unsigned const level {static_cast<unsigned>(order / BITS_PER_LEVEL)};
+            unsigned const slots {1U << (order % BITS_PER_LEVEL)};
+
+            assert (order < sizeof (mword) * 8);
+            assert ((base & ((static_cast<mword>(1) << order) - 1)) == 0);
+
+            mword const last {base + (static_cast<mword>(1) << order) - 1};
+
+            // An empty tree starts with the required height. Otherwise, the
+            // old root becomes the first child of a new root.
+            unsigned height {root_ ? height_ : 1};
+
+            while (height <= level or not fits (last, height)) {
+                height++;
+            }
+
+            if (not root_) {
+                Atomic::store (root_, alloc_node());
+                Atomic::store (height_, height);
+            }
+
+            while (height_ < height) {
+                Node *const n {alloc_node()};
+
+                n->slot[0] = from_node (root_);
+                n->used    = 1;
+
+                Atomic::store (root_->parent, n);
+
+                Atomic::store (root_, n);
+                Atomic::store (height_, height_ + 1);
+            }
+
+            Node *n {root_};
+
+            for (unsigned l {height_ - 1}; l > level; l--) {
+                mword &s {n->slot[index (base, l)]};
+
+                if (not s) {
+                    Node *const c {alloc_node()};
+
+                    c->parent = n;
+                    Atomic::store (s, from_node (c));
+                    n->used++;
+                    n = c;
+
+                } else if (is_node (s)) {
+                    n = to_node (s);
+
+                } else {
+                    return false;
+                }
+            }
+
+            unsigned const first {index (base, level)};
+
+            for (unsigned i {first}; i < first + slots; i++) {
+                if (n->slot[i]) {
+                    return false;
+                }
+            }
+
+            for (unsigned i {first}; i < first + slots; i++) {
+                Atomic::store (n->slot[i], from_entry (e));
+            }
+
+            n->used += slots;
+
+            return true;
+        }
+
+        // Removes an entry. Fails, if it is not in the tree.
+        bool remove (ENTRY *e)
+        {
+            mword const    base  {e->node_base};
+            mword const    order {e->node_order};
+            unsigned const level {static_cast<unsigned>(order / BITS_PER_LEVEL)};
+            unsigned const slots {1U << (order % BITS_PER_LEVEL)};
+
+            if (not root_ or height_ <= level or not fits (base, height_)) {
+                return false;
+            }
+
+            // The nodes from the root down to the level of the entry.
+            Node *path[MAX_LEVELS];
+            Node *n {root_};
+
+            for (unsigned l {height_ - 1}; l > level; l--) {
+                mword const s {n->slot[index (base, l)]};
+
+                if (not is_node (s)) {
+                    return false;
+                }
+
+                path[l] = n;
+                n = to_node (s);
+            }
+
+            unsigned const first {index (base, level)};
+
+            if (n->slot[first] != from_entry (e)) {
+                return false;
+            }
+
+            for (unsigned i {first}; i < first + slots; i++) {
+                Atomic::store (n->slot[i], static_cast<mword>(0));
+            }
+
+            n->used -= slots;
+
+            // Unlink nodes that became empty.
+            for (unsigned l {level}; n->used == 0; l++) {
+                if (l == height_ - 1) {
+                    Atomic::store (root_, static_cast<Node *>(nullptr));
+                    Atomic::store (height_, 0U);
+                    alloc_.free_deferred (n);
+                    break;
+                }
+
+                Node *const parent {path[l + 1]};
+
+                Atomic::store (parent->slot[index (base, l + 1)], static_cast<mword>(0));
+                parent->used--;
+
+                alloc_.free_deferred (n);
+                n = parent;
+            }
+
+            return true;
+        }
+};
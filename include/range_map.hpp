@@ -0,0 +1,150 @@
+/*
+ * Map from address ranges to values
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "assert.hpp"
+#include "compiler.hpp"
+#include "types.hpp"
+
+// A map that assigns a value to every address in [0, limit).
+//
+// The map is stored as a sorted array of boundaries. Each boundary holds the
+// value for all addresses up to the next boundary. Adjacent ranges always
+// have different values, so a lookup returns the largest range with a uniform
+// value in a single binary search. Addresses that were never set have a
+// value-initialized value.
+template <typename VALUE, size_t N>
+class Range_map
+{
+    public:
+        struct Range
+        {
+            uint64 start, end;
+            VALUE value;
+
+            bool operator==(Range const &rhs) const
+            {
+                return start == rhs.start and end == rhs.end and value == rhs.value;
+            }
+        };
+
+    private:
+        struct Boundary
+        {
+            uint64 start;
+            VALUE value;
+        };
+
+        uint64 const limit_;
+
+        // The first boundary always starts at zero.
+        Boundary boundaries_[N] {};
+        size_t size_ {1};
+
+        // Returns the index of the boundary that covers addr.
+        size_t find(uint64 addr) const
+        {
+            size_t lo {0}, hi {size_};
+
+            while (hi - lo > 1) {
+                size_t const mid {lo + (hi - lo) / 2};
+
+                if (boundaries_[mid].start <= addr) {
+                    lo = mid;
+                } else {
+                    hi = mid;
+                }
+            }
+
+            return lo;
+        }
+
+        void insert(size_t i, Boundary const &b)
+        {
+            assert (size_ < N);
+
+            for (size_t j {size_}; j > i; j--) {
+                boundaries_[j] = boundaries_[j - 1];
+            }
+
+            boundaries_[i] = b;
+            size_++;
+        }
+
+        void erase(size_t from, size_t to)
+        {
+            for (size_t j {to}; j < size_; j++) {
+                boundaries_[from + j - to] = boundaries_[j];
+            }
+
+            size_ -= to - from;
+        }
+
+    public:
+        // Returns the number of ranges.
+        size_t size() const { return size_; }
+
+        // Set the value of all addresses in [start, end).
+        //
+        // Returns false, if the map ran out of space. The map is unchanged in
+        // this case.
+        WARN_UNUSED_RESULT bool set(uint64 start, uint64 end, VALUE value)
+        {
+            assert (start < end and end <= limit_);
+
+            // The boundaries that start in [start, end] are replaced by
+            // at most two new ones.
+            size_t const covering {find (start)};
+            size_t const first {covering + (boundaries_[covering].start < start ? 1 : 0)};
+            size_t const last  {end < limit_ ? find (end) + 1 : size_};
+
+            if (size_ - (last - first) + 2 > N) {
+                return false;
+            }
+
+            VALUE const end_value {boundaries_[last - 1].value};
+            bool const same_before {first > 0 and boundaries_[first - 1].value == value};
+            bool const same_after  {end == limit_ or end_value == value};
+
+            erase (first, last);
+
+            size_t pos {first};
+
+            if (not same_before) {
+                insert (pos++, {start, value});
+            }
+
+            if (not same_after) {
+                insert (pos, {end, end_value});
+            }
+
+            return true;
+        }
+
+        // Return the largest range with a uniform value that contains addr.
+        Range lookup(uint64 addr) const
+        {
+            assert (addr < limit_);
+
+            size_t const i {find (addr)};
+
+            return {boundaries_[i].start, i + 1 < size_ ? boundaries_[i + 1].start : limit_, boundaries_[i].value};
+        }
+
+        explicit Range_map(uint64 limit) : limit_ {limit} {}
+};
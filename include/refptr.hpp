@@ -58,6 +58,13 @@ class Refcount
             return Atomic::load (ref) == 1;
         }
 
+        /// Return true, if the object has no other references than the given
+        /// number of references that the caller knows about.
+        bool only_refs (uint32 n)
+        {
+            return Atomic::load (ref) == n;
+        }
+
         /// Delete a reference count similar to del_ref() but already reports
         /// the object ready for destruction when the reference count goes to
         /// one and the caller holds the last reference.
@@ -70,6 +70,7 @@ class Sys_regs
             BAD_FTR,
             BAD_CPU,
             BAD_DEV,
+            BAD_MEM,
         };
 
         inline hypercall_id id() const { return static_cast<hypercall_id>(ARG_1 & 0xF); }
@@ -220,6 +221,10 @@ class Cpu_regs : public Exc_regs
         mword   fs_base;
         mword   gs_base;
 
+        // The host CR3 in the VMCS. It has to follow the PCID of the PD on
+        // this CPU (see Pcid).
+        mword   vmcs_host_cr3;
+
         inline mword hazard() const { return hzd; }
 
         inline void set_hazard (mword h) { Atomic::set_mask (hzd, h); }
@@ -0,0 +1,108 @@
+/*
+ * Temporary mapping slots
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "assert.hpp"
+#include "types.hpp"
+
+// The temporary mapping windows of one CPU (see Hpt::remap).
+//
+// Each slot maps a window of physical memory. A slot stays pinned while
+// anyone uses its mapping. Unpinned slots keep their mapping, so mapping the
+// same memory again is free, until the slot is reused for other memory. The
+// least recently used unpinned slot is reused first.
+class Remap_slots
+{
+    public:
+        static constexpr unsigned NUM_SLOTS {4};
+
+    private:
+        // The physical address that each slot maps.
+        uint64 phys_[NUM_SLOTS] {};
+
+        // The value of clock_ when each slot was last used. Zero marks an
+        // unused slot.
+        uint64 last_used_[NUM_SLOTS] {};
+        uint64 clock_ {0};
+
+        unsigned pins_[NUM_SLOTS] {};
+
+    public:
+        // Pin a slot that maps the given physical address. If the slot has to
+        // be taken from other memory, fresh is true and the caller has to
+        // establish the mapping and invalidate the old one.
+        //
+        // Returns NUM_SLOTS, if all slots are pinned.
+        unsigned acquire(uint64 phys, bool &fresh)
+        {
+            unsigned victim {NUM_SLOTS};
+
+            clock_++;
+
+            for (unsigned i {0}; i < NUM_SLOTS; i++) {
+                if (last_used_[i] != 0 and phys_[i] == phys) {
+                    last_used_[i] = clock_;
+                    pins_[i]++;
+                    fresh = false;
+                    return i;
+                }
+
+                if (pins_[i] == 0 and (victim == NUM_SLOTS or last_used_[i] < last_used_[victim])) {
+                    victim = i;
+                }
+            }
+
+            if (victim == NUM_SLOTS) {
+                return NUM_SLOTS;
+            }
+
+            phys_[victim]      = phys;
+            last_used_[victim] = clock_;
+            pins_[victim]++;
+            fresh = true;
+
+            return victim;
+        }
+
+        // Returns the number of slots that are not pinned.
+        unsigned unpinned() const
+        {
+            unsigned count {0};
+
+            for (unsigned i {0}; i < NUM_SLOTS; i++) {
+                count += pins_[i] == 0 ? 1 : 0;
+            }
+
+            return count;
+        }
+
+        // Returns the address of the window of a slot, if the windows of all
+        // slots are consecutive starting at base.
+        static uint64 window(uint64 base, unsigned slot, uint64 size)
+        {
+            return base + slot * size;
+        }
+
+        // Unpin a slot that was returned by acquire.
+        void release(unsigned slot)
+        {
+            assert (slot < NUM_SLOTS and pins_[slot] > 0);
+
+            pins_[slot]--;
+        }
+};
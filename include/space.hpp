@@ -20,16 +20,46 @@
 
 #pragma once
 
+#include "atomic.hpp"
+#include "radix_tree.hpp"
 #include "spinlock.hpp"
 
-class Avl;
 class Mdb;
+class Rcu_elem;
+class Slab_cache;
 
 class Space
 {
     private:
+        class Node_alloc
+        {
+            private:
+                static Slab_cache cache;
+
+                // A tree node and the RCU element that frees it.
+                struct Rcu_node;
+
+                static void free_rcu (Rcu_elem *);
+
+            public:
+                void *alloc();
+                void free (void *);
+
+                // Frees the node after lookups that may still see it.
+                void free_deferred (void *);
+        };
+
+        // Serializes changes to the tree. Lookups don't take the lock.
         Spinlock    lock;
-        Avl *       tree {nullptr};
+
+        // The mapping database nodes of this space indexed by selector.
+        Radix_tree<Mdb, Node_alloc> tree;
+
+        // Odd while the tree is changed. Lookups that overlap with a change
+        // are repeated, because they may see a partial change.
+        mword       seq {0};
+
+        void tree_changing() { Atomic::add (seq, static_cast<mword>(1)); }
 
     public:
         enum Subspace : mword {
@@ -38,6 +68,24 @@ class Space
             SUBSPACE_GUEST  = 1U << 2,
         };
 
+        // Visits the mapping database nodes of a space in order, starting
+        // with the node that covers idx or the next one after it.
+        class Cursor
+        {
+            private:
+                Space &                               space;
+                Radix_tree<Mdb, Node_alloc>::Cursor   pos;
+
+                // The change count of the tree when pos was last valid.
+                // Odd means never.
+                mword                                 seq {1};
+
+            public:
+                Cursor (Space &s, mword idx) : space (s), pos (idx) {}
+
+                Mdb *next();
+        };
+
         Mdb *tree_lookup (mword idx, bool next = false);
 
         static bool tree_insert (Mdb *node);
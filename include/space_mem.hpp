@@ -21,12 +21,16 @@
 #pragma once
 
 #include "config.hpp"
+#include "cow_pool.hpp"
 #include "cpu.hpp"
 #include "cpuset.hpp"
 #include "hpt.hpp"
+#include "page_alloc_policy.hpp"
 #include "dpt.hpp"
 #include "ept.hpp"
+#include "range_map.hpp"
 #include "space.hpp"
+#include "spinlock.hpp"
 #include "tlb_cleanup.hpp"
 
 class Space_mem
@@ -41,9 +45,22 @@ class Space_mem
 
         mword did;
 
+        // Unique for the lifetime of the system. Identifies this memory space
+        // in the PCID slots of each CPU (see Pcid).
+        uint64 const generation;
+
+        // DMA is translated by the ept instead of the dpt. The guest and
+        // device memory spaces are then one and the same.
+        bool const dma_uses_ept {false};
+
         // A bitmask of CPUs that have at least one EC in this PD.
         Cpuset cpus;
 
+        // A bitmask of CPUs that may hold host TLB entries of this memory
+        // space. A CPU sets its bit when it switches to this memory space and
+        // clears it once it flushed all of them (see tlb_dropped).
+        Cpuset active;
+
         // A bitmask of all CPUs that may have stale host page table mappings of
         // this Space_mem's Hpt cached in their TLB.
         Cpuset stale_host_tlb;
@@ -52,15 +69,62 @@ class Space_mem
         // of this Space_mem's ept or npt cached in their TLB.
         Cpuset stale_guest_tlb;
 
+        // The host virtual addresses that may be stale in the TLBs of the CPUs
+        // in stale_host_range_cpus. They are kept until all of these CPUs
+        // invalidated them. Both are protected by stale_host_lock.
+        Tlb_ranges stale_host_ranges;
+        Cpuset stale_host_range_cpus;
+        Spinlock stale_host_lock;
+
+        // The pages for the copies of copy-on-write pages and the lock that
+        // serializes resolving copy-on-write faults (see resolve_cow).
+        Cow_pool<Page_alloc_policy<>> cow_pool;
+        Spinlock cow_lock;
+
+        // TLB statistics of this memory space (see machine_ctrl_tlb_stats).
+        // They are updated atomically by all CPUs.
+        struct Tlb_stats
+        {
+            // The number of CPUs interrupted by shootdowns for this space.
+            mword shootdown_ipis {0};
+
+            // The number of times a CPU invalidated stale host TLB entries of
+            // this space by flushing the whole TLB or individual pages.
+            mword flush_full {0};
+            mword flush_ranged {0};
+
+            // The number of INVEPTs for stale guest TLB entries.
+            mword invept {0};
+        } tlb_stats;
+
         static unsigned did_ctr;
+        static uint64   generation_ctr;
+
+        // The physical address space that userspace can map.
+        static constexpr unsigned PHYS_BITS {48};
 
-        // Constructor for the initial kernel memory space. The HPT doubles as
-        // database, which memory is safe to give to userspace.
-        Space_mem() : hpt (Hpt::make_golden_hpt()), did (Atomic::add (did_ctr, 1U)) {}
+        // The database of physical memory that is safe to give to userspace.
+        //
+        // For each physical address, it holds the page table attributes
+        // including the memory type (see Hpt::PTE_MT_MASK). Non-delegatable
+        // memory has no attributes. It is filled via insert_root.
+        using Phys_db = Range_map<Hpt::pte_t, 512>;
+        static Phys_db &phys_db();
+
+        // Constructor for the initial kernel memory space. Its page table is
+        // never used. Memory is delegated from the kernel memory space
+        // according to phys_db.
+        Space_mem() : did (Atomic::add (did_ctr, 1U)), generation (Atomic::add (generation_ctr, static_cast<uint64>(1))) {}
 
         // Constructor for normal memory spaces. The hpt parameter is the source
-        // page table to populate kernel mappings.
-        explicit Space_mem(Hpt &src) : hpt (src.deep_copy (LINK_ADDR, SPC_LOCAL)), did (Atomic::add (did_ctr, 1U)) {}
+        // page table for kernel mappings. Only the page tables for the
+        // space-local region starting at SPC_LOCAL are private to this memory
+        // space, all other kernel mappings are shared with src. If
+        // share_ept is true, the ept is also used for DMA (see
+        // Dmar::can_share_ept).
+        explicit Space_mem(Hpt &src, bool share_ept = false)
+            : hpt (src.shallow_copy (CPU_REMAP, SPC_LOCAL)), did (Atomic::add (did_ctr, 1U)),
+              generation (Atomic::add (generation_ctr, static_cast<uint64>(1))), dma_uses_ept (share_ept) {}
 
         NONNULL inline bool lookup (mword virt, Paddr *phys)
         {
@@ -82,18 +146,69 @@ class Space_mem
         // Claim a page for kernel use.
         //
         // Create a mapping for a physical memory region in the kernel page
-        // tables and, if exclusive is true, prevent userspace from mapping this
-        // page. order is given as byte order.
-        void claim (mword virt, unsigned o, mword attr, Paddr phys, bool exclusive);
+        // tables. order is given as byte order. The region stays in the
+        // physical memory database, so the roottask can still delegate it
+        // from the hypervisor PD.
+        void claim (mword virt, unsigned o, mword attr, Paddr phys);
 
         // Convenience wrapper around claim() for single MMIO pages.
-        void claim_mmio_page (mword virt, Paddr phys, bool exclusive = true);
+        void claim_mmio_page (mword virt, Paddr phys);
+
+        // Reserve the page tables that mapping m into the given subspaces
+        // needs. Returns false, if there is not enough memory.
+        NOINLINE bool reserve_tables (Hpt::Mapping const &m, mword sub, Dpt::Page_pool &dpt_pool,
+                                      Ept::Page_pool &ept_pool, Hpt::Page_pool &hpt_pool);
+
+        // Replace the copy-on-write page at page with a copy from the pool in
+        // the subspaces whose attributes are not zero (see resolve_cow).
+        NOINLINE bool copy_cow_page (Tlb_cleanup &cleanup, mword page, Paddr old_phys, Hpt::pte_t host_attr,
+                                     Hpt::pte_t nested_attr, Ept::pte_t guest_attr, Dpt::pte_t device_attr);
 
         // Delegate memory from one memory space to another.
-        Tlb_cleanup delegate (Space_mem *snd, mword snd_base, mword rcv_base, mword ord, mword attr, mword sub);
+        //
+        // If share is true, suitably aligned page tables of the sender are
+        // shared by reference instead of copying their entries (see
+        // Generic_page_table::share_from).
+        //
+        // Returns false, if there was not enough memory for new page tables.
+        // The memory is delegated up to the chunk that needed them. Unmapping
+        // (attr 0) never fails.
+        WARN_UNUSED_RESULT bool delegate (Tlb_cleanup &cleanup, Space_mem *snd, mword snd_base, mword rcv_base,
+                                          mword ord, mword attr, mword sub, bool share = false);
+
+        // Returns the number of page tables used by the guest page table.
+        long guest_table_pages() const;
 
         // Revoke specific rights from a region of memory.
-        Tlb_cleanup revoke (mword vaddr, mword ord, mword attr);
+        //
+        // Revoking read access unmaps the region. Write and execute rights are
+        // removed in place without unmapping. If cow is true, the host
+        // mappings in the region are marked as copy-on-write.
+        Tlb_cleanup revoke (mword vaddr, mword ord, mword attr, bool cow = false);
+
+        // Let the copy-on-write pool of this memory space allocate as many
+        // copies as snd maps writable pages in the given region. snd loses
+        // all its mappings in the region.
+        void donate (Tlb_cleanup &cleanup, Space_mem *snd, mword snd_base, mword ord);
+
+        // Resolve a write fault at vaddr in the host or, if guest_fault is
+        // true, the guest memory space by copying the faulting copy-on-write
+        // page into a page from the pool. The copy replaces the page in all
+        // subspaces that map it at vaddr. Returns false, if the fault is not a
+        // copy-on-write fault or the pool is empty.
+        bool resolve_cow (mword vaddr, bool guest_fault, Tlb_cleanup &cleanup);
+
+        // Mark the host TLB entries that cleanup invalidates as stale on all
+        // CPUs that may hold TLB entries of this memory space.
+        void mark_stale_host_tlb (Tlb_cleanup const &cleanup);
+
+        // Add the host TLB ranges that are stale on the current CPU to ranges.
+        // The CPU has to clear its bit in stale_host_tlb first.
+        void take_stale_host_tlb (Tlb_ranges &ranges);
+
+        // The current CPU does not hold any host TLB entries of this memory
+        // space anymore.
+        void tlb_dropped();
 
         static void shootdown();
 
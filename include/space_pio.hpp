@@ -20,6 +20,7 @@
 
 #pragma once
 
+#include "bitmap.hpp"
 #include "space.hpp"
 #include "tlb_cleanup.hpp"
 
@@ -35,14 +36,14 @@ class Space_pio : public Space
             return SPC_LOCAL_IOP + (idx / 8 / sizeof (mword)) * sizeof (mword);
         }
 
-        static inline mword idx_to_mask (mword idx)
-        {
-            return 1UL << (idx % (8 * sizeof (mword)));
-        }
+        // The two pages of an I/O permission bitmap.
+        using Io_bitmap = Bitmap<mword, 1UL << 16>;
+
+        static_assert (sizeof (Io_bitmap) == 2 * PAGE_SIZE, "I/O permission bitmaps span two pages");
 
         inline Space_mem *space_mem();
 
-        void update (bool, mword, mword);
+        void update (bool, mword, mword, mword);
 
     public:
 
@@ -47,6 +47,8 @@ class Sys_create_pd : public Sys_regs
         inline Crd crd() const { return Crd (ARG_3); }
 
         inline bool is_passthrough() const { return flags() & 0x1; }
+
+        inline bool is_dma_ept() const { return flags() & 0x2; }
 };
 
 class Sys_create_ec : public Sys_regs
@@ -272,6 +274,8 @@ class Sys_machine_ctrl : public Sys_regs
         {
             SUSPEND = 0,
             UPDATE_MICROCODE = 1,
+            PAGE_TABLE_STATS = 2,
+            TLB_STATS = 3,
         };
 
         inline ctrl_op op() const { return static_cast<ctrl_op>(flags() & 0x3); }
@@ -300,3 +304,40 @@ class Sys_machine_ctrl_update_microcode : public Sys_machine_ctrl
         inline unsigned size() const { return static_cast<unsigned>(ARG_1) >> 8; }
         inline mword update_address() const { return static_cast<mword>(ARG_2); }
 };
+
+class Sys_machine_ctrl_page_table_stats : public Sys_machine_ctrl
+{
+    public:
+        inline unsigned long pd() const { return ARG_1 >> 8; }
+
+        inline void set_table_pages (mword host, mword guest, mword device)
+        {
+            ARG_2 = host;
+            ARG_3 = guest;
+            ARG_4 = device;
+        }
+};
+
+class Sys_machine_ctrl_tlb_stats : public Sys_machine_ctrl
+{
+    public:
+        enum class stats_set
+        {
+            PD = 0,
+            CPU_SHOOTDOWN = 1,
+            CPU_FLUSH = 2,
+        };
+
+        inline stats_set set() const { return static_cast<stats_set>(flags() >> 2); }
+
+        // A PD selector or a CPU number depending on the set.
+        inline unsigned long target() const { return ARG_1 >> 8; }
+
+        inline void set_counters (mword c1, mword c2, mword c3, mword c4)
+        {
+            ARG_2 = c1;
+            ARG_3 = c2;
+            ARG_4 = c3;
+            ARG_5 = c4;
+        }
+};
@@ -20,6 +20,9 @@
 #include "assert.hpp"
 #include "buddy.hpp"
 #include "compiler.hpp"
+#include "counter.hpp"
+#include "math.hpp"
+#include "tlb_ranges.hpp"
 #include "types.hpp"
 #include "util.hpp"
 
@@ -29,27 +32,112 @@
 // specific to the page table in question.
 class Tlb_cleanup
 {
-        bool tlb_flush_ {false};
+        // The virtual addresses whose TLB entries are stale.
+        Tlb_ranges tlb_ranges_;
+
+        // Page table memory that has to be written back for non-coherent
+        // page table walkers. The ranges are aligned to cache lines.
+        struct Cache_range
+        {
+            mword start, end;
+        };
+
+        static constexpr size_t MAX_CACHE_RANGES {4};
+
+        Cache_range cache_ranges_[MAX_CACHE_RANGES];
+        size_t num_cache_ranges_ {0};
+
+        // The number of cache lines written back via this object.
+        size_t flushed_lines_ {0};
 
     public:
         using pointer = mword *;
 
+        // Returns the number of cache lines that were written back.
+        size_t flushed_lines() const { return flushed_lines_; }
+
+        // Schedule a write-back of the given page table memory.
+        //
+        // Overlapping and adjacent ranges are merged, so each cache line is
+        // only flushed once. If we run out of space to track ranges, the
+        // pending ranges are flushed early.
+        template <typename FLUSH>
+        void flush_cache_later(FLUSH &flush, void *p, size_t n)
+        {
+            mword const start {align_dn (reinterpret_cast<mword>(p), FLUSH::line_size)};
+            mword const end   {align_up (reinterpret_cast<mword>(p) + n, FLUSH::line_size)};
+
+            for (size_t i {0}; i < num_cache_ranges_; i++) {
+                Cache_range &range {cache_ranges_[i]};
+
+                if (start <= range.end and end >= range.start) {
+                    range.start = min (range.start, start);
+                    range.end   = max (range.end, end);
+                    return;
+                }
+            }
+
+            if (num_cache_ranges_ == MAX_CACHE_RANGES) {
+                flush_caches (flush);
+            }
+
+            cache_ranges_[num_cache_ranges_++] = {start, end};
+        }
+
+        // Write back all scheduled page table memory and wait for completion.
+        template <typename FLUSH>
+        void flush_caches(FLUSH &flush)
+        {
+            if (num_cache_ranges_ == 0) {
+                return;
+            }
+
+            for (size_t i {0}; i < num_cache_ranges_; i++) {
+                Cache_range const &range {cache_ranges_[i]};
+                flushed_lines_ += flush.clflush (reinterpret_cast<void *>(range.start), range.end - range.start);
+            }
+
+            num_cache_ranges_ = 0;
+            flush.fence();
+        }
+
         // Returns true, if a TLB flush is scheduled.
-        WARN_UNUSED_RESULT bool need_tlb_flush() const { return tlb_flush_; }
+        WARN_UNUSED_RESULT bool need_tlb_flush() const { return not tlb_ranges_.empty(); }
+
+        // Returns the virtual address ranges that need to be invalidated.
+        Tlb_ranges const &tlb_ranges() const { return tlb_ranges_; }
 
         // Discard a scheduled TLB flush.
         //
         // This should be done with care as wrong usage will end up in TLB
         // invalidation bugs.
-        void ignore_tlb_flush() { tlb_flush_ = false; }
+        void ignore_tlb_flush()
+        {
+            if (need_tlb_flush()) {
+                Counter::tlb_flush_ignored()++;
+            }
+
+            tlb_ranges_.clear();
+        }
+
+        // Forget a scheduled TLB flush after the caller invalidated the
+        // stale TLB entries.
+        void tlb_flush_done() { tlb_ranges_.clear(); }
 
-        // Schedule a TLB flush.
-        void flush_tlb_later() { tlb_flush_ = true; }
+        // Schedule a flush of the whole TLB.
+        void flush_tlb_later() { tlb_ranges_.add_all(); }
+
+        // Schedule a TLB flush for the given range that is mapped with pages
+        // of 2^stride_order bytes.
+        void flush_tlb_later(mword vaddr, mword size, unsigned stride_order)
+        {
+            tlb_ranges_.add (vaddr, size, stride_order);
+        }
 
         // Free all pages that were marked for deferred reclamation immediately.
         void free_pages_now()
         {
-            assert(not tlb_flush_);
+            assert(not need_tlb_flush());
 
             // Not implemented yet.
         }
@@ -60,7 +148,11 @@ class Tlb_cleanup
         // actually happens.
         void free_later(pointer page)
         {
-            tlb_flush_ = true;
+            // Invalidating any single page also drops all cached paging
+            // structures, so only an empty set needs to become a full flush.
+            if (tlb_ranges_.empty()) {
+                tlb_ranges_.add_all();
+            }
 
             // This is not correct, because we need to defer freeing this page
             // until the TLB flush has happened. As the broken behavior was
@@ -77,13 +169,18 @@ class Tlb_cleanup
         template <typename CLEANUP>
         void merge(CLEANUP &&rhs)
         {
-            tlb_flush_ |= rhs.tlb_flush_;
-            rhs.ignore_tlb_flush();
+            assert (rhs.num_cache_ranges_ == 0);
+
+            tlb_ranges_.add (rhs.tlb_ranges_);
+            flushed_lines_ += rhs.flushed_lines_;
+
+            rhs.tlb_ranges_.clear();
+            rhs.flushed_lines_ = 0;
         }
 
         Tlb_cleanup &operator=(Tlb_cleanup &&rhs)
         {
-            assert (not tlb_flush_);
+            assert (not need_tlb_flush());
 
             merge(rhs);
             return *this;
@@ -98,7 +195,12 @@ class Tlb_cleanup
         Tlb_cleanup(Tlb_cleanup const &rhs) = delete;
 
         Tlb_cleanup() = default;
-        explicit Tlb_cleanup(bool tlb_flush) : tlb_flush_ {tlb_flush} {}
+        explicit Tlb_cleanup(bool tlb_flush)
+        {
+            if (tlb_flush) {
+                tlb_ranges_.add_all();
+            }
+        }
 
         // A named convenience constructor for readable code.
         static Tlb_cleanup tlb_flush(bool tlb_flush)
@@ -108,9 +210,11 @@ class Tlb_cleanup
 
         ~Tlb_cleanup()
         {
+            assert (num_cache_ranges_ == 0);
+
             // Once we fully implement this class, at destruction time there
             // should be no TLB flush pending and all pages can be freed.
             //
-            // assert (not tlb_flush_);
+            // assert (not need_tlb_flush());
         }
 };
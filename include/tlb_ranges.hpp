@@ -0,0 +1,149 @@
+/*
+ * Virtual address ranges with stale TLB entries
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#pragma once
+
+#include "memory.hpp"
+#include "types.hpp"
+
+// A small set of virtual address ranges whose TLB entries have to be
+// invalidated.
+//
+// Each range is invalidated with one instruction per page of the given stride,
+// which is the page size of the mappings in the range. Invalidating many pages
+// individually is slower than flushing the whole TLB, so the set degrades to a
+// full flush once it covers too many pages or runs out of space.
+class Tlb_ranges
+{
+    public:
+        // The maximum number of pages that are invalidated individually.
+        static constexpr size_t MAX_PAGES {32};
+
+    private:
+        static constexpr size_t MAX_RANGES {2};
+
+        // The ranges have to be small, because Tlb_cleanup objects live on
+        // the stack. Ranges start at page boundaries, so the low bits of the
+        // start address hold the order of the stride.
+        mword range_start_[MAX_RANGES];
+        uint8 range_pages_[MAX_RANGES];
+
+        uint8 num_ranges_ {0};
+        uint8 num_pages_ {0};
+
+        bool full_ {false};
+
+        static_assert (MAX_PAGES <= 0xff, "Page counts have to fit into uint8");
+
+        static mword    start_of (mword range)        { return range & ~PAGE_MASK; }
+        static unsigned stride_order_of (mword range) { return static_cast<unsigned>(range & PAGE_MASK); }
+
+    public:
+        // Returns true, if there is nothing to invalidate.
+        bool empty() const { return num_ranges_ == 0 and not full_; }
+
+        // Returns true, if the whole TLB has to be flushed.
+        bool full() const { return full_; }
+
+        // Returns the number of pages that are invalidated individually.
+        size_t pages() const { return num_pages_; }
+
+        void clear()
+        {
+            num_ranges_ = 0;
+            num_pages_  = 0;
+            full_       = false;
+        }
+
+        // Require a flush of the whole TLB.
+        void add_all()
+        {
+            clear();
+            full_ = true;
+        }
+
+        // Add the range [start, start + size) that is mapped with pages of
+        // 2^stride_order bytes.
+        void add(mword start, mword size, unsigned stride_order)
+        {
+            if (full_) {
+                return;
+            }
+
+            mword  const stride {static_cast<mword>(1) << stride_order};
+            mword  const first  {start & ~(stride - 1)};
+            size_t const pages  {static_cast<size_t>((start + size - first + stride - 1) >> stride_order)};
+
+            if (num_pages_ + pages > MAX_PAGES) {
+                add_all();
+                return;
+            }
+
+            num_pages_ = static_cast<uint8>(num_pages_ + pages);
+
+            // Extend an existing range that ends where this one starts.
+            for (size_t i {0}; i < num_ranges_; i++) {
+                mword const range {range_start_[i]};
+
+                if (stride_order_of (range) == stride_order and
+                    start_of (range) + (static_cast<mword>(range_pages_[i]) << stride_order) == first) {
+                    range_pages_[i] = static_cast<uint8>(range_pages_[i] + pages);
+                    return;
+                }
+            }
+
+            if (num_ranges_ == MAX_RANGES) {
+                add_all();
+                return;
+            }
+
+            range_start_[num_ranges_] = first | stride_order;
+            range_pages_[num_ranges_] = static_cast<uint8>(pages);
+            num_ranges_++;
+        }
+
+        // Add all ranges of another set.
+        void add(Tlb_ranges const &rhs)
+        {
+            if (rhs.full_) {
+                add_all();
+                return;
+            }
+
+            for (size_t i {0}; i < rhs.num_ranges_; i++) {
+                unsigned const stride_order {stride_order_of (rhs.range_start_[i])};
+
+                add (start_of (rhs.range_start_[i]), static_cast<mword>(rhs.range_pages_[i]) << stride_order,
+                     stride_order);
+            }
+        }
+
+        // Call fn with one address in each page that has to be invalidated.
+        //
+        // Must not be called for a full set.
+        template <typename FN>
+        void for_each_page(FN const &fn) const
+        {
+            for (size_t i {0}; i < num_ranges_; i++) {
+                unsigned const stride_order {stride_order_of (range_start_[i])};
+
+                for (mword page {0}; page < range_pages_[i]; page++) {
+                    fn (start_of (range_start_[i]) + (page << stride_order));
+                }
+            }
+        }
+};
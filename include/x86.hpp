@@ -31,6 +31,27 @@ inline void clflush (T *t)
     asm volatile ("clflush %0" : : "m" (*t) : "memory");
 }
 
+// Weakly-ordered variant of clflush. Needs a fence to be ordered with
+// respect to later stores.
+template <typename T>
+inline void clflushopt (T *t)
+{
+    asm volatile ("clflushopt %0" : : "m" (*t) : "memory");
+}
+
+// Write back a cache line without necessarily evicting it. Needs a fence
+// like clflushopt.
+template <typename T>
+inline void clwb (T *t)
+{
+    asm volatile ("clwb %0" : : "m" (*t) : "memory");
+}
+
+inline void sfence()
+{
+    asm volatile ("sfence" : : : "memory");
+}
+
 NONNULL
 inline void *clflush (void *d, size_t n)
 {
@@ -99,6 +120,13 @@ inline void set_cr2 (mword cr2)
     asm volatile ("mov %0, %%cr2" : : "r" (cr2));
 }
 
+inline mword get_cr3()
+{
+    mword cr3;
+    asm volatile ("mov %%cr3, %0" : "=r" (cr3));
+    return cr3;
+}
+
 inline mword get_cr4()
 {
     mword cr4;
@@ -27,6 +27,7 @@
 #include "acpi_mcfg.hpp"
 #include "acpi_rsdp.hpp"
 #include "acpi_rsdt.hpp"
+#include "cpu.hpp"
 #include "gsi.hpp"
 #include "hpt.hpp"
 #include "io.hpp"
@@ -57,26 +58,23 @@ void Acpi::reset()
 
 Acpi_table_facs Acpi::get_facs()
 {
-    return *static_cast<Acpi_table_facs *>(Hpt::remap (facs));
+    return *Hpt::remap (facs).get<Acpi_table_facs>();
 }
 
 void Acpi::set_facs (Acpi_table_facs const &saved_facs)
 {
-    *static_cast<Acpi_table_facs *>(Hpt::remap (facs)) = saved_facs;
+    *Hpt::remap (facs).get<Acpi_table_facs>() = saved_facs;
 }
 
 Paddr Acpi::get_waking_vector()
 {
-    // It's unfortunate that we have hardcode which page table we are using for
-    // remap. See #119.
-    Acpi_table_facs * const facsp = static_cast<Acpi_table_facs *>(Hpt::remap (facs, false));
-
-    return facsp->firmware_waking_vector;
+    return Hpt::remap (facs).get<Acpi_table_facs>()->firmware_waking_vector;
 }
 
 void Acpi::set_waking_vector (Paddr vector, Wake_mode mode)
 {
-    Acpi_table_facs * const facsp = static_cast<Acpi_table_facs *>(Hpt::remap (facs));
+    auto const map {Hpt::remap (facs)};
+    Acpi_table_facs * const facsp = map.get<Acpi_table_facs>();
 
     // We don't implement protected or long mode wake up, because firmware
     // doesn't correctly implement these.
@@ -120,24 +118,29 @@ void Acpi::setup()
     if (!xsdt && !rsdt)
         Acpi_rsdp::parse();
 
+    // The RSDT stays mapped while its tables are mapped (see
+    // Acpi_table_rsdt::parse).
+    assert (Hpt::remap_available() >= 2);
+
     if (xsdt)
-        static_cast<Acpi_table_rsdt *>(Hpt::remap (xsdt))->parse (xsdt, sizeof (uint64));
+        Hpt::remap (xsdt).get<Acpi_table_rsdt>()->parse (xsdt, sizeof (uint64));
     else if (rsdt)
-        static_cast<Acpi_table_rsdt *>(Hpt::remap (rsdt))->parse (rsdt, sizeof (uint32));
+        Hpt::remap (rsdt).get<Acpi_table_rsdt>()->parse (rsdt, sizeof (uint32));
 
     if (fadt)
-        static_cast<Acpi_table_fadt *>(Hpt::remap (fadt))->parse();
+        Hpt::remap (fadt).get<Acpi_table_fadt>()->parse();
     if (hpet)
-        static_cast<Acpi_table_hpet *>(Hpt::remap (hpet))->parse();
+        Hpt::remap (hpet).get<Acpi_table_hpet>()->parse();
     if (madt)
-        static_cast<Acpi_table_madt *>(Hpt::remap (madt))->parse();
+        Hpt::remap (madt).get<Acpi_table_madt>()->parse();
     if (mcfg)
-        static_cast<Acpi_table_mcfg *>(Hpt::remap (mcfg))->parse();
+        Hpt::remap (mcfg).get<Acpi_table_mcfg>()->parse();
     if (dmar)
-        static_cast<Acpi_table_dmar *>(Hpt::remap (dmar))->parse();
+        Hpt::remap (dmar).get<Acpi_table_dmar>()->parse();
 
     if (facs) {
-        Acpi_table_facs * const facsp = static_cast<Acpi_table_facs *>(Hpt::remap (facs));
+        auto const map {Hpt::remap (facs)};
+        Acpi_table_facs * const facsp = map.get<Acpi_table_facs>();
 
         trace (TRACE_ACPI, "%.4s:%#010lx VER:%2d FLAGS:%#x HW:%#010x LEN:%5u",
                reinterpret_cast<char const *>(&facsp->signature),
@@ -158,7 +161,13 @@ void Acpi::setup()
         Acpi_table_madt::parse_intr (&sci_override);
     }
 
-    Gsi::set (gsi = Gsi::irq_to_gsi (irq));
+    gsi = Gsi::irq_to_gsi (irq);
+
+    // The SCI is routed to the boot CPU.
+    if (Gsi::can_target (0))
+        Gsi::set (gsi);
+    else
+        trace (TRACE_ERROR, "ACPI: Cannot route SCI to APIC ID %#x", Cpu::apic_id[0]);
 
     Acpi::init();
 
@@ -168,7 +177,7 @@ void Acpi::setup()
 void Acpi::init()
 {
     if (fadt) {
-        static_cast<Acpi_table_fadt *>(Hpt::remap (fadt))->init();
+        Hpt::remap (fadt).get<Acpi_table_fadt>()->init();
     }
 
     if (Acpi_table_madt::pic_present) {
@@ -26,11 +26,13 @@
 #include "gsi.hpp"
 #include "io.hpp"
 #include "ioapic.hpp"
+#include "stdio.hpp"
 #include "vectors.hpp"
 
 void Acpi_table_madt::parse() const
 {
     parse_entry (Acpi_apic::LAPIC,  &parse_lapic);
+    parse_entry (Acpi_apic::X2APIC, &parse_x2apic);
     parse_entry (Acpi_apic::IOAPIC, &parse_ioapic);
     parse_entry (Acpi_apic::INTR,   &parse_intr);
 
@@ -48,10 +50,35 @@ void Acpi_table_madt::parse_lapic (Acpi_apic const *ptr)
 {
     Acpi_lapic const *p = static_cast<Acpi_lapic const *>(ptr);
 
-    if (p->flags & 1 && Cpu::online < NUM_CPU) {
-        Cpu::acpi_id[Cpu::online]   = p->acpi_id;
-        Cpu::apic_id[Cpu::online++] = p->apic_id;
+    add_cpu (p->flags, p->acpi_id, p->apic_id);
+}
+
+void Acpi_table_madt::parse_x2apic (Acpi_apic const *ptr)
+{
+    Acpi_x2apic const *p = static_cast<Acpi_x2apic const *>(ptr);
+
+    add_cpu (p->flags, p->acpi_id, p->apic_id);
+}
+
+void Acpi_table_madt::add_cpu (uint32 flags, uint32 acpi_id, uint32 apic_id)
+{
+    if (!(flags & 1) || Cpu::online >= NUM_CPU)
+        return;
+
+    // The HIP reports 8-bit ACPI processor IDs. Skipped CPUs still receive
+    // the broadcast SIPI and park themselves in the start code.
+    if (acpi_id > 0xff) {
+        trace (TRACE_ERROR, "Skipping CPU with APIC ID %#x and ACPI ID %#x", apic_id, acpi_id);
+        return;
     }
+
+    // Some firmware describes the same CPU with both structure types.
+    for (unsigned i = 0; i < Cpu::online; i++)
+        if (Cpu::apic_id[i] == apic_id)
+            return;
+
+    Cpu::acpi_id[Cpu::online]   = static_cast<uint8>(acpi_id);
+    Cpu::apic_id[Cpu::online++] = apic_id;
 }
 
 void Acpi_table_madt::parse_ioapic (Acpi_apic const *ptr)
@@ -51,16 +51,25 @@ void Acpi_rsdp::parse (mword rdsp_addr)
         rsdp = reinterpret_cast<Acpi_rsdp *>(rdsp_addr);
         if (not (rsdp->good_signature() and rsdp->good_checksum()))
             return;
-    } else {
-        mword map = reinterpret_cast<mword>(Hpt::remap (rdsp_addr));
 
-        if (!(rsdp = Acpi_rsdp::find (map + (*reinterpret_cast<uint16 *>(map + 0x40e) << 4), 0x400)) &&
-            !(rsdp = Acpi_rsdp::find (map + 0xe0000, 0x20000)))
-            return;
+        rsdp->use();
+        return;
     }
 
-    Acpi::rsdt = rsdp->rsdt_addr;
+    auto const bios {Hpt::remap (rdsp_addr)};
+    mword map = reinterpret_cast<mword>(bios.get());
+
+    if (!(rsdp = Acpi_rsdp::find (map + (*reinterpret_cast<uint16 *>(map + 0x40e) << 4), 0x400)) &&
+        !(rsdp = Acpi_rsdp::find (map + 0xe0000, 0x20000)))
+        return;
+
+    rsdp->use();
+}
+
+void Acpi_rsdp::use() const
+{
+    Acpi::rsdt = rsdt_addr;
 
-    if (rsdp->revision > 1 && rsdp->good_checksum (rsdp->length))
-        Acpi::xsdt = static_cast<Paddr>(rsdp->xsdt_addr);
+    if (revision > 1 && good_checksum (length))
+        Acpi::xsdt = static_cast<Paddr>(xsdt_addr);
 }
@@ -44,7 +44,8 @@ void Acpi_table_rsdt::parse (Paddr addr, size_t size) const
 
     for (unsigned i = 0; i < count; i++) {
 
-        Acpi_table *acpi = static_cast<Acpi_table *>(Hpt::remap (table[i]));
+        auto const mapping {Hpt::remap (table[i])};
+        Acpi_table *acpi = mapping.get<Acpi_table>();
 
         if (acpi->good_checksum (table[i]))
             for (unsigned j = 0; j < sizeof map / sizeof *map; j++)
@@ -19,6 +19,7 @@
  */
 
 #include "assert.hpp"
+#include "atomic.hpp"
 #include "buddy.hpp"
 #include "initprio.hpp"
 #include "lock_guard.hpp"
@@ -87,6 +88,22 @@ void Buddy::fill(void *dst, Fill fill_mem, size_t size)
  * @return          Pointer to linear memory region
  */
 void *Buddy::alloc (unsigned short ord, Fill fill_mem)
+{
+    void *virt = try_alloc (ord, fill_mem);
+
+    if (!virt)
+        Console::panic ("Out of memory");
+
+    return virt;
+}
+
+/*
+ * Allocate physically contiguous memory region, if there is one.
+ * @param ord       Block order (2^ord pages)
+ * @param fill      Initialization mode of allocated memory
+ * @return          Pointer to linear memory region or nullptr
+ */
+void *Buddy::try_alloc (unsigned short ord, Fill fill_mem)
 {
     Lock_guard <Spinlock> guard (lock);
 
@@ -100,6 +117,7 @@ void *Buddy::alloc (unsigned short ord, Fill fill_mem)
         block->next->prev = block->prev;
         block->ord = ord;
         block->tag = Block::Used;
+        block->refs = 0;
 
         while (j-- != ord) {
             Block *buddy = block + (1ul << j);
@@ -119,7 +137,7 @@ void *Buddy::alloc (unsigned short ord, Fill fill_mem)
         return reinterpret_cast<void *>(virt);
     }
 
-    Console::panic ("Out of memory");
+    return nullptr;
 }
 
 /*
@@ -138,6 +156,9 @@ void Buddy::free (mword virt)
     // Ensure block is marked as used
     assert (block->tag == Block::Used);
 
+    // Ensure nobody else references the block
+    assert (block->refs == 0);
+
     // Ensure corresponding physical block is order-aligned
     assert ((virt_to_phys (virt) & ((1ul << (block->ord + PAGE_BITS)) - 1)) == 0);
 
@@ -178,3 +199,36 @@ void Buddy::free (mword virt)
     block->next = h->next;
     block->next->prev = h->next = block;
 }
+
+void Buddy::ref (mword virt)
+{
+    signed long idx = page_to_index (virt);
+
+    assert (idx >= min_idx && idx < max_idx);
+    assert (index_to_block (idx)->tag == Block::Used);
+
+    Atomic::add (index_to_block (idx)->refs, 1U);
+}
+
+bool Buddy::unref (mword virt)
+{
+    signed long idx = page_to_index (virt);
+
+    if (idx < min_idx || idx >= max_idx)
+        return true;
+
+    Block *block = index_to_block (idx);
+
+    for (unsigned refs = Atomic::load (block->refs); refs != 0; refs = Atomic::load (block->refs))
+        if (Atomic::cmp_swap (block->refs, refs, refs - 1))
+            return false;
+
+    return true;
+}
+
+bool Buddy::shared (mword virt)
+{
+    signed long idx = page_to_index (virt);
+
+    return idx >= min_idx && idx < max_idx && Atomic::load (index_to_block (idx)->refs) != 0;
+}
@@ -28,6 +28,7 @@ struct Cmdline::param_map const Cmdline::map[] =
     { "serial",     &Cmdline::serial    },
     { "nodl",       &Cmdline::nodl      },
     { "nopcid",     &Cmdline::nopcid    },
+    { "nox2apic",   &Cmdline::nox2apic  },
     { "novga",      &Cmdline::novga     },
     { "novpid",     &Cmdline::novpid    },
 };
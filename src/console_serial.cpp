@@ -31,7 +31,8 @@ Console_serial::Console_serial()
     if (!Cmdline::serial)
         return;
 
-    char *mem = static_cast<char *>(Hpt::remap (0));
+    auto const map {Hpt::remap (0)};
+    char *mem = map.get<char>();
     if (!(base = *reinterpret_cast<uint16 *>(mem + 0x400)) &&
         !(base = *reinterpret_cast<uint16 *>(mem + 0x402)))
         base = 0x3f8;
@@ -29,7 +29,7 @@ Console_vga::Console_vga() : num (25), row (0), col (0)
     if (Cmdline::novga)
         return;
 
-    Pd::kern->claim_mmio_page(HV_GLOBAL_FBUF, 0xb9000, false);
+    Pd::kern->claim_mmio_page(HV_GLOBAL_FBUF, 0xb9000);
 
     set_page (1);
 
@@ -54,7 +54,7 @@ char const * const Cpu::vendor_string[] =
 // Order of these matters
 unsigned    Cpu::online;
 uint8       Cpu::acpi_id[NUM_CPU];
-uint8       Cpu::apic_id[NUM_CPU];
+uint32      Cpu::apic_id[NUM_CPU];
 Cpu::lapic_info_t Cpu::lapic_info[NUM_CPU];
 
 static bool probe_spec_ctrl()
@@ -166,6 +166,7 @@ Cpu_info Cpu::check_features()
 
     // Disable features based on command line arguments
     if (EXPECT_FALSE (Cmdline::nopcid))  { defeature (FEAT_PCID);  }
+    if (EXPECT_FALSE (Cmdline::nox2apic)) { defeature (FEAT_X2APIC); }
 
     return cpu_info;
 }
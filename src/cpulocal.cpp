@@ -24,6 +24,8 @@
 
 alignas(PAGE_SIZE) Per_cpu Cpulocal::cpu[NUM_CPU];
 
+bool Cpulocal::ready;
+
 Per_cpu &Cpulocal::get_remote(unsigned cpu_id)
 {
     assert (cpu_id < NUM_CPU);
@@ -33,6 +35,12 @@ Per_cpu &Cpulocal::get_remote(unsigned cpu_id)
 mword Cpulocal::setup_cpulocal()
 {
     unsigned cpu_id {Cpu::find_by_apic_id (Lapic::early_id())};
+
+    // The broadcast SIPI also starts CPUs that were not enumerated from the
+    // MADT. They have no CPU-local memory and are parked by the caller.
+    if (EXPECT_FALSE (cpu_id >= NUM_CPU))
+        return 0;
+
     Per_cpu &local {cpu[cpu_id]};
 
     local.cpu_id = cpu_id;
@@ -41,5 +49,7 @@ mword Cpulocal::setup_cpulocal()
     Msr::write (Msr::IA32_GS_BASE, gs_base);
     Msr::write (Msr::IA32_KERNEL_GS_BASE, 0);
 
+    ready = true;
+
     return gs_base;
 }
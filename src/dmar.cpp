@@ -21,10 +21,12 @@
 
 #include "dmar.hpp"
 #include "dpt.hpp"
+#include "ept.hpp"
 #include "lapic.hpp"
 #include "pd.hpp"
 #include "stdio.hpp"
 #include "vectors.hpp"
+#include "vmx.hpp"
 
 INIT_PRIORITY (PRIO_SLAB)
 Slab_cache  Dmar::cache (sizeof (Dmar), 8);
@@ -33,6 +35,7 @@ Dmar *      Dmar::list;
 Dmar_ctx *  Dmar::ctx = new Dmar_ctx;
 Dmar_irt *  Dmar::irt = new Dmar_irt;
 uint32      Dmar::gcmd = GCMD_TE;
+bool        Dmar::ept_walk = true;
 
 Dmar::Dmar (Paddr p) : Forward_list<Dmar> (list), reg_base ((hwdev_addr -= PAGE_SIZE) | (p & PAGE_MASK)), invq (static_cast<Dmar_qi *>(Buddy::allocator.alloc (ord, Buddy::FILL_0))), invq_idx (0)
 {
@@ -48,6 +51,8 @@ Dmar::Dmar (Paddr p) : Forward_list<Dmar> (list), reg_base ((hwdev_addr -= PAGE_
     assert (page_table_levels() >= leaf_levels);
     Dpt::lower_supported_leaf_levels (leaf_levels);
 
+    ept_walk = ept_walk and coherent() and four_levels();
+
     if (ir()) {
       gcmd |= GCMD_IRE;
     }
@@ -90,10 +95,16 @@ int Dmar::page_table_levels() const
     return static_cast<int>(lev);
 }
 
+bool Dmar::can_share_ept()
+{
+    return list != nullptr and ept_walk and Vmcs::has_ept()
+        and Dpt::get_supported_leaf_levels() >= Ept::get_supported_leaf_levels();
+}
+
 void Dmar::assign (unsigned long rid, Pd *p)
 {
     Dmar_ctx *r = ctx + (rid >> 8);
-    int const lev {page_table_levels()};
+    int const lev {p->dma_uses_ept ? p->ept.max_levels() : page_table_levels()};
 
     if (!r->present())
         r->set (0, Buddy::ptr_to_phys (new Dmar_ctx) | 1);
@@ -104,7 +115,7 @@ void Dmar::assign (unsigned long rid, Pd *p)
 
     flush_ctx();
 
-    auto const root {p->dpt.root (lev)};
+    auto const root {p->dma_uses_ept ? p->ept.root() : p->dpt.root (lev)};
     auto const address_width {static_cast<mword> (lev) - 2};
 
     c->set (address_width | p->did << 8, root | 1);
@@ -86,7 +86,8 @@ Ec::Ec (Pd *own, mword sel, Pd *p, void (*f)(), unsigned c, unsigned e, mword u,
         regs.spec_ctrl = 0;
 
         if (Hip::feature() & Hip::FEAT_VMX) {
-            mword host_cr3 = pd->hpt.root() | (Cpu::feature (Cpu::FEAT_PCID) ? pd->did : 0);
+            // The PCID is filled in on VM entry.
+            mword host_cr3 = pd->hpt.root();
 
             regs.vmcs = new Vmcs (reinterpret_cast<mword>(sys_regs() + 1),
                                   pd->Space_pio::walk(),
@@ -94,6 +95,8 @@ Ec::Ec (Pd *own, mword sel, Pd *p, void (*f)(), unsigned c, unsigned e, mword u,
                                   pd->ept,
                                   c);
 
+            regs.vmcs_host_cr3 = host_cr3;
+
             regs.nst_ctrl<Vmcs>();
 
             /* Host MSRs are restored in the exit path. */
@@ -311,6 +314,11 @@ void Ec::ret_user_vmresume()
 
     regs.vmcs->make_current();
 
+    if (mword const host_cr3 {get_cr3()}; EXPECT_FALSE (host_cr3 != regs.vmcs_host_cr3)) {
+        current()->regs.vmcs_host_cr3 = host_cr3;
+        Vmcs::write (Vmcs::HOST_CR3, host_cr3);
+    }
+
     if (EXPECT_FALSE (Pd::current()->stale_guest_tlb.chk (Cpu::id()))) {
         Pd::current()->stale_guest_tlb.clr (Cpu::id());
 
@@ -318,6 +326,9 @@ void Ec::ret_user_vmresume()
         // paging structures might have changed and INVVPID does not flush
         // guest-physical mappings.
         Pd::current()->ept.invalidate();
+
+        Counter::invept()++;
+        Atomic::add (Pd::current()->tlb_stats.invept, static_cast<mword>(1));
     }
 
     if (EXPECT_FALSE (get_cr2() != regs.cr2)) {
@@ -403,47 +414,70 @@ void Ec::idle()
         if (EXPECT_FALSE (hzd))
             handle_hazard (hzd, idle);
 
+        // PDs that were destroyed shouldn't be kept alive by their PCIDs
+        // while we sleep.
+        Pd::release_pcids();
+
         asm volatile ("sti; hlt; cli" : : : "memory");
     }
 }
 
 void Ec::root_invoke()
 {
-    Eh *e = static_cast<Eh *>(Hpt::remap (Hip::root_addr, false));
-    if (!Hip::root_addr || e->ei_magic != 0x464c457f || e->ei_class != ELF_CLASS || e->ei_data != 1 || e->type != 2 || e->machine != ELF_MACHINE)
-        die ("No ELF");
+    // The roottask PD is new, so no TLB entries can become stale. Like a
+    // delegation via pd_ctrl, running out of memory fails the roottask
+    // instead of the hypervisor.
+    auto const map_root {[] (mword phys, mword virt, mword ord, mword attr) {
+        Tlb_cleanup cleanup;
+
+        if (not Pd::current()->Space_mem::delegate (cleanup, &Pd::kern, phys, virt, ord, attr, Space::SUBSPACE_HOST))
+            die ("Out of memory");
+    }};
 
-    unsigned count = e->ph_count;
-    current()->regs.set_pt (Cpu::id());
-    current()->regs.set_ip (e->entry);
-    current()->regs.set_sp (USER_ADDR - PAGE_SIZE);
+    // The ELF header stays mapped while the program headers are mapped.
+    assert (Hpt::remap_available() >= 2);
 
-    ELF_PHDR *p = static_cast<ELF_PHDR *>(Hpt::remap (Hip::root_addr + e->ph_offset, false));
+    {
+        auto const elf {Hpt::remap (Hip::root_addr)};
 
-    for (unsigned i = 0; i < count; i++, p++) {
+        Eh *e = elf.get<Eh>();
+        if (!Hip::root_addr || e->ei_magic != 0x464c457f || e->ei_class != ELF_CLASS || e->ei_data != 1 || e->type != 2 || e->machine != ELF_MACHINE)
+            die ("No ELF");
 
-        if (p->type == 1) {
+        unsigned count = e->ph_count;
+        current()->regs.set_pt (Cpu::id());
+        current()->regs.set_ip (e->entry);
+        current()->regs.set_sp (USER_ADDR - PAGE_SIZE);
 
-            unsigned attr =
-                ((p->flags & 0x4) ? Mdb::MEM_R : 0) |
-                ((p->flags & 0x2) ? Mdb::MEM_W : 0) |
-                ((p->flags & 0x1) ? Mdb::MEM_X : 0);
+        auto const phdrs {Hpt::remap (Hip::root_addr + e->ph_offset)};
 
-            if (p->f_size != p->m_size || p->v_addr % PAGE_SIZE != p->f_offs % PAGE_SIZE)
-                die ("Bad ELF");
+        ELF_PHDR *p = phdrs.get<ELF_PHDR>();
 
-            mword phys = align_dn (p->f_offs + Hip::root_addr, PAGE_SIZE);
-            mword virt = align_dn (p->v_addr, PAGE_SIZE);
-            mword size = align_up (p->f_size, PAGE_SIZE);
+        for (unsigned i = 0; i < count; i++, p++) {
 
-            for (unsigned long o; size; size -= 1UL << o, phys += 1UL << o, virt += 1UL << o) {
-                Pd::current()->delegate<Space_mem>(&Pd::kern, phys >> PAGE_BITS, virt >> PAGE_BITS, (o = min (max_order (phys, size), max_order (virt, size))) - PAGE_BITS, attr, Space::SUBSPACE_HOST);
+            if (p->type == 1) {
+
+                unsigned attr =
+                    ((p->flags & 0x4) ? Mdb::MEM_R : 0) |
+                    ((p->flags & 0x2) ? Mdb::MEM_W : 0) |
+                    ((p->flags & 0x1) ? Mdb::MEM_X : 0);
+
+                if (p->f_size != p->m_size || p->v_addr % PAGE_SIZE != p->f_offs % PAGE_SIZE)
+                    die ("Bad ELF");
+
+                mword phys = align_dn (p->f_offs + Hip::root_addr, PAGE_SIZE);
+                mword virt = align_dn (p->v_addr, PAGE_SIZE);
+                mword size = align_up (p->f_size, PAGE_SIZE);
+
+                for (unsigned long o; size; size -= 1UL << o, phys += 1UL << o, virt += 1UL << o) {
+                    map_root (phys, virt, o = min (max_order (phys, size), max_order (virt, size)), attr);
+                }
             }
         }
     }
 
     // Map hypervisor information page
-    Pd::current()->delegate<Space_mem>(&Pd::kern, Buddy::ptr_to_phys (&PAGE_H) >> PAGE_BITS, (USER_ADDR - PAGE_SIZE) >> PAGE_BITS, 0, Mdb::MEM_R, Space::SUBSPACE_HOST);
+    map_root (Buddy::ptr_to_phys (&PAGE_H), USER_ADDR - PAGE_SIZE, PAGE_BITS, Mdb::MEM_R);
 
     Space_obj::insert_root (Pd::current());
     Space_obj::insert_root (Ec::current());
@@ -70,8 +70,17 @@ bool Ec::handle_exc_pf (Exc_regs *r)
 {
     mword addr = r->cr2;
 
-    if (r->err & Hpt::ERR_U)
-        return false;
+    // User writes to copy-on-write pages are resolved here, if the PD
+    // donated memory for the copies. Everything else goes to the pager.
+    if (r->err & Hpt::ERR_U) {
+        Tlb_cleanup cleanup;
+
+        if (not (r->err & Hpt::ERR_W) or not Pd::current()->resolve_cow (addr, false, cleanup))
+            return false;
+
+        Pd::tlb_shootdown (cleanup);
+        return true;
+    }
 
     // Kernel fault in I/O space
     if (addr >= SPC_LOCAL_IOP && addr <= SPC_LOCAL_IOP_E) {
@@ -88,6 +97,17 @@ bool Ec::handle_exc_pf (Exc_regs *r)
     die ("#PF (kernel)", r);
 }
 
+bool Ec::handle_guest_cow (mword gpa)
+{
+    Tlb_cleanup cleanup;
+
+    if (not Pd::current()->resolve_cow (gpa, true, cleanup))
+        return false;
+
+    Pd::tlb_shootdown (cleanup);
+    return true;
+}
+
 void Ec::handle_exc (Exc_regs *r)
 {
     assert (r->vec == r->dst_portal);
@@ -51,6 +51,14 @@ void Ec::handle_svm()
             reason = NUM_VMI - 4;
             current()->regs.nst_error = static_cast<mword>(current()->regs.vmcb->exitinfo1);
             current()->regs.nst_fault = static_cast<mword>(current()->regs.vmcb->exitinfo2);
+
+            // Writes to copy-on-write pages don't need the VMM. The error
+            // code has the #PF format. Faults during event delivery are left
+            // to the VMM, which reinjects the event.
+            if ((current()->regs.nst_error & Hpt::ERR_W) and
+                not (current()->regs.vmcb->exitintinfo & 0x80000000) and
+                handle_guest_cow (current()->regs.nst_fault))
+                ret_user_vmrun();
             break;
     }
 
@@ -108,6 +108,15 @@ void Ec::handle_vmx()
         case Vmcs::VMX_EPT_VIOLATION:
             current()->regs.nst_error = Vmcs::read (Vmcs::EXI_QUALIFICATION);
             current()->regs.nst_fault = Vmcs::read (Vmcs::INFO_PHYS_ADDR);
+
+            // Writes to copy-on-write pages don't need the VMM. Bit 1 of the
+            // qualification marks data writes. Faults during event delivery
+            // or with NMI unblocking (bit 12) need state fixups that are left
+            // to the VMM.
+            if ((current()->regs.nst_error & 0x1002) == 0x2 and
+                not (Vmcs::read (Vmcs::IDT_VECT_INFO) & 0x80000000) and
+                handle_guest_cow (current()->regs.nst_fault))
+                ret_user_vmresume();
             break;
         case Vmcs::VMX_PREEMPT:
             // Whenever a preemption timer exit occurs we set the value to the
@@ -55,8 +55,15 @@ void Gsi::set_polarity (unsigned gsi, bool level, bool active_low)
     gsi_table[gsi].pol = active_low;
 }
 
+bool Gsi::can_target (unsigned cpu)
+{
+    return Cpu::apic_id[cpu] <= 0xff;
+}
+
 uint64 Gsi::set (unsigned gsi, unsigned cpu, unsigned rid)
 {
+    assert (can_target (cpu));
+
     uint32 msi_addr = 0, msi_data = 0, aid = Cpu::apic_id[cpu];
 
     Ioapic *ioapic = gsi_table[gsi].ioapic;
@@ -89,7 +89,8 @@ void Hip::build (mword magic, mword addr)
 
 void Hip::build_mbi1 (Hip_mem *&mem, mword addr)
 {
-    Multiboot const *mbi = static_cast<Multiboot const *>(Hpt::remap (addr));
+    auto const map {Hpt::remap (addr)};
+    Multiboot const *mbi = map.get<Multiboot const>();
 
     uint32 flags       = mbi->flags;
     uint32 mmap_addr   = mbi->mmap_addr;
@@ -98,12 +99,13 @@ void Hip::build_mbi1 (Hip_mem *&mem, mword addr)
     uint32 mods_count  = mbi->mods_count;
 
     if (flags & Multiboot::MEMORY_MAP) {
-        char const *remap = static_cast<char const *>(Hpt::remap (mmap_addr));
-        mbi->for_each_mem (remap, mmap_len, [&mem] (Multiboot_mmap const * mmap) { Hip::add_mem (mem, mmap); });
+        auto const mem_map {Hpt::remap (mmap_addr)};
+        mbi->for_each_mem (mem_map.get<char const>(), mmap_len, [&mem] (Multiboot_mmap const * mmap) { Hip::add_mem (mem, mmap); });
     }
 
     if (flags & Multiboot::MODULES) {
-        Multiboot_module *mod = static_cast<Multiboot_module *>(Hpt::remap (mods_addr));
+        auto const mods {Hpt::remap (mods_addr)};
+        Multiboot_module *mod = mods.get<Multiboot_module>();
         for (unsigned i = 0; i < mods_count; i++, mod++)
             add_mod (mem, mod, mod->cmdline);
     }
@@ -111,7 +113,8 @@ void Hip::build_mbi1 (Hip_mem *&mem, mword addr)
 
 void Hip::build_mbi2 (Hip_mem *&mem, mword addr)
 {
-    Multiboot2::Header const *mbi = static_cast<Multiboot2::Header const *>(Hpt::remap (addr));
+    auto const map {Hpt::remap (addr)};
+    Multiboot2::Header const *mbi = map.get<Multiboot2::Header const>();
 
     mbi->for_each_tag ([&mem, mbi, addr](Multiboot2::Tag const * tag) {
         if (tag->type == Multiboot2::TAG_MEMORY)
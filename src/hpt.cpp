@@ -15,30 +15,33 @@
  * GNU General Public License version 2 for more details.
  */
 
+#include "cpulocal.hpp"
 #include "hpt.hpp"
 #include "nodestruct.hpp"
 #include "mdb.hpp"
 #include "pd.hpp"
+#include "stdio.hpp"
 
 Hpt::level_t Hpt::supported_leaf_levels {2};
 
-Hpt Hpt::deep_copy(mword vaddr_start, mword vaddr_end)
+Hpt Hpt::shallow_copy(mword vaddr_start, mword vaddr_end)
 {
-    Hpt::Mapping map;
+    // Each PDPT entry covers 1 GiB. We link the page directories below it.
+    ord_t const order {PAGE_BITS + 2 * 9};
+    mword const size {1UL << order};
+
+    assert (is_aligned_by_order (vaddr_end, order));
+
     Hpt dst;
     Tlb_cleanup cleanup;
 
-    for (mword vaddr {vaddr_start}; vaddr < vaddr_end; vaddr += map.size()) {
-        map = lookup (vaddr);
+    for (mword vaddr {align_dn (vaddr_start, size)}; vaddr < vaddr_end; vaddr += size) {
 
-        if (not (map.present())) {
-            continue;
-        }
+        // Regions without any mappings yet need a page table in the source
+        // as well, otherwise later mappings would not be shared.
+        walk_down_and_split (cleanup, vaddr, 1);
 
-        // We don't handle the case where vaddr_start and vaddr_end point into
-        // the middle mappings, but this case should also never happen.
-        assert (map.vaddr >= vaddr_start and map.vaddr + map.size() <= vaddr_end);
-        dst.update (cleanup, map);
+        dst.link_from (cleanup, *this, vaddr, order);
     }
 
     // We populate an empty page table that is also not yet used anywhere.
@@ -56,10 +59,23 @@ Hpt &Hpt::boot_hpt()
 
 const size_t Hpt::remap_guaranteed_size {0x200000};
 
-void *Hpt::remap (Paddr phys, bool use_boot_hpt)
+static_assert (NUM_CPU * Remap_slots::NUM_SLOTS * 2 * 0x200000 <= CPU_REMAP_E - CPU_REMAP,
+               "Temporary mapping windows do not fit");
+static_assert (Remap_slots::NUM_SLOTS * 2 * 0x200000 <= BOOT_REMAP_E - BOOT_REMAP,
+               "Boot mapping windows do not fit");
+
+// The windows that are used before CPU-local memory is set up. Only the BSP
+// runs at this point. They have their own address range, because the BSP
+// keeps track of its later windows in separate slots.
+static Remap_slots boot_remap_slots;
+
+unsigned Hpt::remap_available()
 {
-    Tlb_cleanup cleanup;
+    return (Cpulocal::is_ready() ? Cpulocal::get().hpt_remap_slots : boot_remap_slots).unpinned();
+}
 
+Hpt::Remapping Hpt::remap (Paddr phys)
+{
     // We map 4MB in total: First the 2MB page where phys lands in and the next
     // one. This means the user of this function can safely access memory up to
     // 2MB.
@@ -70,19 +86,39 @@ void *Hpt::remap (Paddr phys, bool use_boot_hpt)
 
     phys &= ~page_mask;
 
-    mword attr {Hpt::PTE_W | Hpt::PTE_P | Hpt::PTE_NX};
+    bool const early {not Cpulocal::is_ready()};
 
-    // This manual distinction is unfortunate, but when creating the roottask
-    // the current PD is not the boot page table anymore.
-    Hpt &hpt {use_boot_hpt ? boot_hpt() : Pd::current()->hpt};
+    Remap_slots &slots {early ? boot_remap_slots : Cpulocal::get().hpt_remap_slots};
+    mword const base {early ? BOOT_REMAP : CPU_REMAP + Cpu::id() * Remap_slots::NUM_SLOTS * 2 * size};
 
-    hpt.update(cleanup, {SPC_LOCAL_REMAP,        phys,        attr, order});
-    hpt.update(cleanup, {SPC_LOCAL_REMAP + size, phys + size, attr, order});
+    bool fresh;
+    unsigned const slot {slots.acquire (phys, fresh)};
 
-    // We always need to flush the TLB.
-    hpt.flush();
+    if (EXPECT_FALSE (slot == Remap_slots::NUM_SLOTS)) {
+        Console::panic ("Out of temporary mapping windows");
+    }
+
+    mword const window {Remap_slots::window (base, slot, 2 * size)};
+
+    if (fresh) {
+        Tlb_cleanup cleanup;
+
+        // The windows of a CPU are never accessed by other CPUs, so we only
+        // invalidate them locally. The mappings are global, because INVLPG
+        // would not reach the TLB entries of other PCIDs otherwise. The boot
+        // page table shares this region with all other page tables.
+        mword attr {Hpt::PTE_G | Hpt::PTE_W | Hpt::PTE_P | Hpt::PTE_NX};
+
+        boot_hpt().update(cleanup, {window,        phys,        attr, order});
+        boot_hpt().update(cleanup, {window + size, phys + size, attr, order});
+
+        invalidate (window);
+        invalidate (window + size);
+
+        cleanup.tlb_flush_done();
+    }
 
-    return reinterpret_cast<void *>(SPC_LOCAL_REMAP + offset);
+    return {slots, slot, window + offset};
 }
 
 Paddr Hpt::replace (mword vaddr, mword paddr)
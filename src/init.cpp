@@ -53,14 +53,20 @@ void init (mword magic, mword mbi)
 
     for (void (**func)() = &CTORS_G; func != &CTORS_E; (*func++)()) ;
 
+    // The multiboot information stays mapped while the command line is
+    // mapped.
+    assert (Hpt::remap_available() >= 2);
+
     if (magic == Multiboot::MAGIC) {
-        Multiboot *mbi_ = static_cast<Multiboot *>(Hpt::remap (mbi));
+        auto const map {Hpt::remap (mbi)};
+        Multiboot *mbi_ = map.get<Multiboot>();
         if (mbi_->flags & Multiboot::CMDLINE)
-            Cmdline::init (static_cast<char const *>(Hpt::remap (mbi_->cmdline)));
+            Cmdline::init (Hpt::remap (mbi_->cmdline).get<char const>());
     }
 
     if (magic == Multiboot2::MAGIC) {
-        Multiboot2::Header const *mbi_ = static_cast<Multiboot2::Header const *>(Hpt::remap (mbi));
+        auto const map {Hpt::remap (mbi)};
+        Multiboot2::Header const *mbi_ = map.get<Multiboot2::Header const>();
         mbi_->for_each_tag ([&](Multiboot2::Tag const *tag) {
             if (tag->type == Multiboot2::TAG_CMDLINE)
                 Cmdline::init (tag->cmdline());
@@ -79,7 +85,8 @@ void init (mword magic, mword mbi)
                      " " ARCH "): " COMPILER_STRING " [%s] \n", reinterpret_cast<mword>(&GIT_VER), get_boot_type(magic));
 
     if (magic == Multiboot2::MAGIC) {
-        Multiboot2::Header const *mbi_ = static_cast<Multiboot2::Header const *>(Hpt::remap (mbi));
+        auto const map {Hpt::remap (mbi)};
+        Multiboot2::Header const *mbi_ = map.get<Multiboot2::Header const>();
         mbi_->for_each_tag ([&](Multiboot2::Tag const *tag) {
             if (tag->type == Multiboot2::TAG_ACPI_2) {
                 Acpi_rsdp::parse (tag->rsdp());
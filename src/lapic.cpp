@@ -26,6 +26,7 @@
 #include "acpi.hpp"
 #include "cmdline.hpp"
 #include "ec.hpp"
+#include "hip.hpp"
 #include "lapic.hpp"
 #include "msr.hpp"
 #include "rcu.hpp"
@@ -36,6 +37,7 @@
 unsigned    Lapic::freq_tsc;
 unsigned    Lapic::freq_bus;
 bool        Lapic::use_tsc_timer {false};
+bool        Lapic::x2apic {false};
 unsigned    Lapic::cpu_park_count;
 
 static char __start_cpu_backup[128];
@@ -51,7 +53,8 @@ uint32 Lapic::prepare_cpu_boot(cpu_boot_type type)
 {
     assert (static_cast<size_t>(__start_cpu_end - __start_cpu) < sizeof(__start_cpu_backup));
 
-    char * const low_memory {static_cast<char *>(Hpt::remap (CPUBOOT_ADDR))};
+    auto const map {Hpt::remap (CPUBOOT_ADDR)};
+    char * const low_memory {map.get<char>()};
 
     memcpy(__start_cpu_backup, low_memory, sizeof(__start_cpu_backup));
     memcpy(low_memory,        __start_cpu, sizeof(__start_cpu_backup));
@@ -84,7 +87,7 @@ uint32 Lapic::prepare_cpu_boot(cpu_boot_type type)
 
 void Lapic::restore_low_memory()
 {
-    memcpy(Hpt::remap (CPUBOOT_ADDR), __start_cpu_backup, sizeof(__start_cpu_backup));
+    memcpy(Hpt::remap (CPUBOOT_ADDR).get(), __start_cpu_backup, sizeof(__start_cpu_backup));
 }
 
 void Lapic::init()
@@ -93,6 +96,14 @@ void Lapic::init()
 
     Msr::write (Msr::IA32_APIC_BASE, apic_base | 0x800);
 
+    // The firmware may have switched to x2APIC mode already, which can only
+    // be left by disabling the local APIC.
+    x2apic = Cpu::feature (Cpu::FEAT_X2APIC) || (apic_base & 0x400);
+
+    // Switching from xAPIC to x2APIC mode has to happen in a separate step.
+    if (x2apic)
+        Msr::write (Msr::IA32_APIC_BASE, apic_base | 0xc00);
+
     assert (Cpu::id() == Cpu::find_by_apic_id (id()));
 
     Cpu::lapic_info[Cpu::id()].id      = read(LAPIC_IDR);
@@ -165,16 +176,85 @@ void Lapic::init()
 
     write (LAPIC_TMR_ICR, 0);
 
-    trace (TRACE_APIC, "APIC:%#lx ID:%#x VER:%#x LVT:%#x (%s Mode)", apic_base & ~PAGE_MASK, id(), version(), lvt_max(), freq_bus ? "OS" : "DL");
+    trace (TRACE_APIC, "APIC:%#lx ID:%#x VER:%#x LVT:%#x (%s Mode%s)", apic_base & ~PAGE_MASK, id(), version(), lvt_max(), freq_bus ? "OS" : "DL", x2apic ? ", x2APIC" : "");
 }
 
-void Lapic::send_ipi (unsigned cpu, unsigned vector, Delivery_mode dlv, Shorthand dsh)
+void Lapic::write_icr (uint32 dst, uint32 icr)
 {
+    if (x2apic) {
+
+        // Writes to the x2APIC MSRs are not serializing. Make sure the
+        // receiver of the IPI observes all preceding stores. There is no
+        // delivery status to wait for in x2APIC mode.
+        asm volatile ("mfence; lfence" : : : "memory");
+
+        Msr::write (x2apic_msr (LAPIC_ICR_LO), static_cast<uint64>(dst) << 32 | icr);
+        return;
+    }
+
     while (EXPECT_FALSE (read (LAPIC_ICR_LO) & 1U << 12))
         pause();
 
-    write (LAPIC_ICR_HI, Cpu::apic_id[cpu] << 24);
-    write (LAPIC_ICR_LO, dsh | 1U << 14 | dlv | vector);
+    write (LAPIC_ICR_HI, dst << 24);
+    write (LAPIC_ICR_LO, icr);
+}
+
+void Lapic::send_ipi (unsigned cpu, unsigned vector, Delivery_mode dlv, Shorthand dsh)
+{
+    write_icr (Cpu::apic_id[cpu], dsh | 1U << 14 | DST_PHYSICAL | dlv | vector);
+}
+
+void Lapic::send_ipi (Cpuset const &cpus, unsigned vector)
+{
+    unsigned targets = 0;
+
+    for (unsigned cpu = 0; cpu < NUM_CPU; cpu++)
+        if (cpus.chk (cpu))
+            targets++;
+
+    assert (!cpus.chk (Cpu::id()));
+
+    if (!targets)
+        return;
+
+    // Broadcasting hits a few CPUs needlessly, but a single ICR write is
+    // cheaper than one per target.
+    unsigned const others = Cpu::online - 1;
+
+    if (targets + others / 8 >= others) {
+        write_icr (0, DSH_EXC_SELF | 1U << 14 | DLV_FIXED | vector);
+        return;
+    }
+
+    if (!x2apic) {
+        for (unsigned cpu = 0; cpu < NUM_CPU; cpu++)
+            if (cpus.chk (cpu))
+                send_ipi (cpu, vector);
+
+        return;
+    }
+
+    // In x2APIC mode, the logical destination of a CPU is derived from its
+    // APIC ID: Bits 31:16 select a cluster of 16 CPUs and bits 15:0 select
+    // CPUs in the cluster. Send one IPI per cluster.
+    Cpuset todo {cpus};
+
+    for (unsigned cpu = 0; cpu < NUM_CPU; cpu++) {
+
+        if (!todo.chk (cpu))
+            continue;
+
+        uint32 const cluster = Cpu::apic_id[cpu] >> 4;
+        uint32 mask = 0;
+
+        for (unsigned i = cpu; i < NUM_CPU; i++)
+            if (todo.chk (i) && Cpu::apic_id[i] >> 4 == cluster) {
+                mask |= 1U << (Cpu::apic_id[i] & 0xf);
+                todo.clr (i);
+            }
+
+        write_icr (cluster << 16 | mask, 1U << 14 | DST_LOGICAL | DLV_FIXED | vector);
+    }
 }
 
 void Lapic::park_all_but_self(park_fn fn)
@@ -185,7 +265,13 @@ void Lapic::park_all_but_self(park_fn fn)
     Atomic::store (park_function, fn);
     Atomic::store (cpu_park_count, Cpu::online - 1);
 
-    send_ipi (0, VEC_IPI_PRK, DLV_FIXED, DSH_EXC_SELF);
+    Cpuset cpus;
+
+    for (unsigned cpu = 0; cpu < NUM_CPU; cpu++)
+        if (Hip::cpu_online (cpu) && cpu != Cpu::id())
+            cpus.set (cpu);
+
+    send_ipi (cpus, VEC_IPI_PRK);
 
     while (Atomic::load (cpu_park_count) != 0) {
         pause();
@@ -16,54 +16,33 @@
  * GNU General Public License version 2 for more details.
  */
 
+#include "derivation_tree.hpp"
 #include "lock_guard.hpp"
 #include "mdb.hpp"
 
+using Tree = Derivation_tree<Mdb, Lock_guard<Spinlock>>;
+
 INIT_PRIORITY (PRIO_SLAB)
 Slab_cache Mdb::cache (sizeof (Mdb), 16);
 
-Spinlock Mdb::lock;
+static_assert (sizeof (Mdb) == 80, "Mapping database nodes should stay compact");
 
-bool Mdb::insert_node (Mdb *p, mword a)
+Spinlock &Mdb::derivation_lock()
 {
-    Lock_guard <Spinlock> guard (lock);
-
-    if (!p->alive())
-        return false;
-
-    if (!(node_attr = p->node_attr & a))
-        return false;
-
-    prev = prnt = p;
-    next = p->next;
-    dpth = static_cast<uint16>(p->dpth + 1);
-    p->next = p->next->prev = this;
+    return Tree::lock (this);
+}
 
-    return true;
+bool Mdb::insert_node (Mdb *p, mword a)
+{
+    return Tree::insert (this, p, a);
 }
 
 void Mdb::demote_node (mword a)
 {
-    Lock_guard <Spinlock> guard (lock);
-
-    node_attr &= ~a;
+    Tree::demote (this, a);
 }
 
 bool Mdb::remove_node()
 {
-    if (node_attr)
-        return false;
-
-    Lock_guard <Spinlock> guard (lock);
-
-    if (!alive())
-        return false;
-
-    if (next->dpth > dpth)
-        return false;
-
-    next->prev = prev;
-    prev->next = next;
-
-    return true;
+    return Tree::remove (this);
 }
@@ -45,7 +45,7 @@ Pci *Pci::find_dev (unsigned long r)
 
 Pci::Pci (unsigned r, unsigned l) : Forward_list<Pci> (list), reg_base (hwdev_addr -= PAGE_SIZE), rid (static_cast<uint16>(r)), lev (static_cast<uint16>(l))
 {
-    Pd::kern->claim_mmio_page (reg_base, cfg_base + (rid << PAGE_BITS), false);
+    Pd::kern->claim_mmio_page (reg_base, cfg_base + (rid << PAGE_BITS));
 
     for (unsigned i = 0; i < sizeof map / sizeof *map; i++)
         if (read<uint16>(REG_VID) == map[i].vid && read<uint16>(REG_DID) == map[i].did)
@@ -96,7 +96,7 @@ unsigned Pci::scan (unsigned b, unsigned l, unsigned max_bus)
         if ((r << PAGE_BITS) >= cfg_size)
             return current_max;
 
-        if (*static_cast<uint32 *>(Hpt::remap (cfg_base + (r << PAGE_BITS))) == ~0U)
+        if (*Hpt::remap (cfg_base + (r << PAGE_BITS)).get<uint32>() == ~0U)
             continue;
 
         Pci *p = new Pci (r, l);
@@ -47,7 +47,7 @@ Pd::Pd ()
 
     // The memory after the second ELF segment to "infinity".
     mark_avail_phys (reinterpret_cast<mword>(&LOAD_END) + PHYS_RELOCATION,
-                     1ULL << hpt.max_order());
+                     1ULL << PHYS_BITS);
 
     // HIP
     Paddr frame_h = Buddy::ptr_to_phys (&PAGE_H);
@@ -59,7 +59,7 @@ Pd::Pd ()
 
 Pd::Pd (Pd *own, mword sel, mword a, int creation_flags)
     : Typed_kobject (static_cast<Space_obj *>(own), sel, a, free, pre_free),
-      Space_mem (Hpt::boot_hpt()), is_priv(creation_flags & IS_PRIVILEGED),
+      Space_mem (Hpt::boot_hpt(), creation_flags & IS_DMA_EPT), is_priv(creation_flags & IS_PRIVILEGED),
       is_passthrough(creation_flags & IS_PASSTHROUGH)
 {
 }
@@ -71,7 +71,7 @@ Tlb_cleanup Pd::delegate (Pd *snd, mword const snd_base, mword const rcv_base, m
     Tlb_cleanup cleanup;
 
     Mdb *mdb;
-    for (mword addr = snd_base; (mdb = snd->S::tree_lookup (addr, true)); addr = mdb->node_base + (1UL << mdb->node_order)) {
+    for (Space::Cursor cursor {*static_cast<S *>(snd), snd_base}; (mdb = cursor.next());) {
 
         mword o, b = snd_base;
         if ((o = clamp (mdb->node_base, b, mdb->node_order, ord)) == ~0UL)
@@ -91,7 +91,7 @@ Tlb_cleanup Pd::delegate (Pd *snd, mword const snd_base, mword const rcv_base, m
 
         if (!node->insert_node (mdb, attr)) {
             S::tree_remove (node);
-            delete node;
+            Rcu::call (node);
             trace (0, "overmap attempt %s - node - PD:%p->%p SB:%#010lx RB:%#010lx O:%#04lx A:%#lx", deltype, snd, this, snd_base, rcv_base, ord, attr);
             continue;
         }
@@ -102,18 +102,11 @@ Tlb_cleanup Pd::delegate (Pd *snd, mword const snd_base, mword const rcv_base, m
     return cleanup;
 }
 
-template <>
-Tlb_cleanup Pd::delegate<Space_mem> (Pd *snd, mword const snd_base, mword const rcv_base, mword const ord,
-                                     mword const attr, mword const sub, [[maybe_unused]] char const *deltype)
-{
-    return Space_mem::delegate (snd, snd_base << PAGE_BITS, rcv_base << PAGE_BITS, ord + PAGE_BITS, attr, sub);
-}
-
 template <typename S>
 void Pd::revoke (mword const base, mword const ord, mword const attr, bool self)
 {
     Mdb *mdb;
-    for (mword addr = base; (mdb = S::tree_lookup (addr, true)); addr = mdb->node_base + (1UL << mdb->node_order)) {
+    for (Space::Cursor cursor {*static_cast<S *>(this), base}; (mdb = cursor.next());) {
 
         mword o, p, b = base;
         if ((o = clamp (mdb->node_base, b, mdb->node_order, ord)) == ~0UL)
@@ -162,16 +155,115 @@ void Pd::revoke (mword const base, mword const ord, mword const attr, bool self)
 }
 
 template <>
-void Pd::revoke<Space_mem> (mword const base, mword const ord, mword const attr, bool self)
+void Pd::revoke<Space_mem> (mword const base, mword const ord, mword const attr, [[maybe_unused]] bool self)
+{
+    // Memory delegations are not tracked in a mapping database, so there
+    // are no derived mappings to revoke and self makes no difference. Rights
+    // are always removed from this PD. Callers reach the PDs they delegated
+    // to by revoking from them directly (see sys_revoke).
+    Tlb_cleanup cleanup {Space_mem::revoke(base << PAGE_BITS, ord + PAGE_BITS, attr)};
+
+    tlb_shootdown (cleanup);
+}
+
+void Pd::switch_from (Pd *old, bool stale)
 {
-    if (not self) {
-        trace (TRACE_ERROR, "Non-self revocation is not supported: Revoking everything!");
+    // The previous PD stays valid until the next quiescent state of this CPU,
+    // even if we drop the last reference.
+    if (old->del_rcu())
+        Rcu::call (old);
+
+    current() = this;
+
+    bool ok = current()->add_ref();
+    assert (ok);
+
+    unsigned const cpu {Cpu::id()};
+
+    // Announce that we may cache translations before we load them.
+    if (not active.chk (cpu))
+        active.set (cpu);
+
+    // With PCIDs, the TLB entries of this PD survive the switch and only the
+    // stale ones are invalidated below. Pd::kern uses PCID 0, which is flushed
+    // whenever it is loaded.
+    bool const has_pcid {Cpu::feature (Cpu::FEAT_PCID)};
+
+    mword pcid    = 0;
+    bool  fresh   = true;
+    Pd   *evicted = nullptr;
+
+    if (has_pcid and this != &Pd::kern) {
+        pcid = pcids().assign (this, generation, fresh, evicted);
+
+        // A PCID slot holds a reference, so we can tell its owner when the
+        // slot is reused. Slots of PDs that are otherwise unreferenced are
+        // freed when the CPU goes idle (see release_pcids).
+        if (fresh) {
+            ok = add_ref();
+            assert (ok);
+
+            Atomic::add (pcid_refs, 1U);
+        }
     }
 
-    Tlb_cleanup cleanup {Space_mem::revoke(base << PAGE_BITS, ord + PAGE_BITS, attr)};
+    host_hpt().make_current (fresh ? pcid : pcid | static_cast<mword>(1ULL << 63));
+
+    if (EXPECT_FALSE (stale))
+        invalidate_stale_host_tlb (fresh);
+
+    // The TLB entries of the previous PD are gone, unless they are kept in a
+    // PCID slot.
+    if (not has_pcid or old == &Pd::kern)
+        old->tlb_dropped();
 
-    shootdown();
-    cleanup.ignore_tlb_flush();
+    if (evicted) {
+        evicted->tlb_dropped();
+
+        Atomic::sub (evicted->pcid_refs, 1U);
+
+        if (evicted->del_rcu())
+            Rcu::call (evicted);
+    }
+}
+
+void Pd::release_pcids()
+{
+    assert (current() == &Pd::kern);
+
+    // PDs that are still referenced elsewhere keep their slots, so they
+    // find their TLB entries again when they run here next. Nobody can take
+    // new references to the others anymore.
+    while (Pd *pd {pcids().release ([] (Pd *p) { return p->only_refs (Atomic::load (p->pcid_refs)); })}) {
+        pd->tlb_dropped();
+
+        Atomic::sub (pd->pcid_refs, 1U);
+
+        if (pd->del_rcu())
+            Rcu::call (pd);
+    }
+}
+
+void Pd::invalidate_stale_host_tlb (bool tlb_flushed)
+{
+    Tlb_ranges ranges;
+    take_stale_host_tlb (ranges);
+
+    if (tlb_flushed or ranges.empty())
+        return;
+
+    if (ranges.full() or this == &Pd::kern) {
+        Hpt::flush();
+
+        Counter::tlb_flush_full()++;
+        Atomic::add (tlb_stats.flush_full, static_cast<mword>(1));
+        return;
+    }
+
+    ranges.for_each_page ([] (mword vaddr) { Hpt::invalidate (vaddr); });
+
+    Counter::tlb_flush_ranged()++;
+    Atomic::add (tlb_stats.flush_ranged, static_cast<mword>(1));
 }
 
 mword Pd::clamp (mword snd_base, mword &rcv_base, mword snd_ord, mword rcv_ord)
@@ -257,49 +349,87 @@ void Pd::xlt_crd (Pd *pd, Crd xlt, Crd &crd)
     crd = Crd (0);
 }
 
-void Pd::del_crd (Pd *pd, Crd del, Crd &crd, mword sub, mword hot)
+bool Pd::del_crd (Pd *pd, Crd del, Crd &crd, Tlb_cleanup &cleanup, mword sub, mword hot, bool cow, bool share)
 {
     Crd::Type st = crd.type(), rt = del.type();
-    Tlb_cleanup cleanup;
 
     mword a = crd.attr() & del.attr(), sb = crd.base(), so = crd.order(), rb = del.base(), ro = del.order(), o = 0;
 
     if (st != rt or (not a and rt != Crd::MEM)) {
         crd = Crd (0);
-        return;
+        return true;
     }
 
     switch (rt) {
 
         case Crd::MEM:
             o = clamp (sb, rb, so, ro, hot);
-            trace (TRACE_DEL, "DEL MEM PD:%p->%p SB:%#010lx RB:%#010lx O:%#04lx A:%#lx", pd, this, sb, rb, o, a);
-            cleanup = delegate<Space_mem>(pd, sb, rb, o, a, sub, "MEM");
+            trace (TRACE_DEL, "DEL MEM PD:%p->%p SB:%#010lx RB:%#010lx O:%#04lx A:%#lx%s%s", pd, this, sb, rb, o, a,
+                   cow ? " COW" : "", share ? " SHARE" : "");
+
+            // For copy-on-write delegations, the sender loses write access
+            // to all of its mappings before the receiver gets its read-only
+            // copy. Both mark their host mappings, so write faults can be
+            // resolved by copying (see Space_mem::resolve_cow).
+            if (cow) {
+                a &= ~Mdb::MEM_W;
+
+                if (pd != &kern) {
+                    cleanup.merge (pd->Space_mem::revoke (sb << PAGE_BITS, o + PAGE_BITS, Mdb::MEM_W, true));
+                }
+            }
+
+            if (not Space_mem::delegate (cleanup, pd, sb << PAGE_BITS, rb << PAGE_BITS, o + PAGE_BITS, a, sub, share)) {
+                crd = Crd (0);
+                return false;
+            }
+
+            if (cow) {
+                cleanup.merge (Space_mem::revoke (rb << PAGE_BITS, o + PAGE_BITS, Mdb::MEM_W, true));
+            }
             break;
 
         case Crd::PIO:
             o = clamp (sb, rb, so, ro);
             trace (TRACE_DEL, "DEL I/O PD:%p->%p SB:%#010lx RB:%#010lx O:%#04lx A:%#lx", pd, this, rb, rb, o, a);
-            cleanup = delegate<Space_pio>(pd, rb, rb, o, a, sub, "PIO");
+            cleanup.merge (delegate<Space_pio>(pd, rb, rb, o, a, sub, "PIO"));
             break;
 
         case Crd::OBJ:
             o = clamp (sb, rb, so, ro, hot);
             trace (TRACE_DEL, "DEL OBJ PD:%p->%p SB:%#010lx RB:%#010lx O:%#04lx A:%#lx", pd, this, sb, rb, o, a);
-            cleanup = delegate<Space_obj>(pd, sb, rb, o, a, 0, "OBJ");
+            {
+                Tlb_cleanup obj_cleanup {delegate<Space_obj>(pd, sb, rb, o, a, 0, "OBJ")};
+
+                /* if FRAME_0 got replaced by real pages we have to tell all cpus, done by the caller's shootdown */
+                if (obj_cleanup.need_tlb_flush())
+                    mark_stale_host_tlb (obj_cleanup);
+
+                cleanup.merge (obj_cleanup);
+            }
             break;
     }
 
     crd = Crd (rt, rb, o, a);
+    return true;
+}
 
-    if (cleanup.need_tlb_flush() && rt == Crd::OBJ)
-        /* if FRAME_0 got replaced by real pages we have to tell all cpus, done below by shootdown */
-        this->stale_host_tlb.merge (cpus);
+void Pd::don_crd (Pd *pd, Crd del, Crd &crd, Tlb_cleanup &cleanup, mword hot)
+{
+    mword sb = crd.base(), so = crd.order(), rb = del.base(), ro = del.order();
 
-    if (cleanup.need_tlb_flush()) {
-        shootdown();
-        cleanup.ignore_tlb_flush(); // because it is done.
+    if (crd.type() != Crd::MEM or del.type() != Crd::MEM) {
+        crd = Crd (0);
+        return;
     }
+
+    mword o = clamp (sb, rb, so, ro, hot);
+    trace (TRACE_DEL, "DON MEM PD:%p->%p SB:%#010lx O:%#04lx", pd, this, sb, o);
+
+    Space_mem::donate (cleanup, pd, sb << PAGE_BITS, o + PAGE_BITS);
+
+    // Donated memory is not mapped into the receiver.
+    crd = Crd (0);
 }
 
 void Pd::rev_crd (Crd crd, bool self)
@@ -323,7 +453,7 @@ void Pd::rev_crd (Crd crd, bool self)
     }
 }
 
-Xfer Pd::xfer_item (Pd *src_pd, Crd xlt, Crd del, Xfer s_ti)
+Xfer Pd::xfer_item (Pd *src_pd, Crd xlt, Crd del, Xfer s_ti, Tlb_cleanup &cleanup, bool *out_of_memory)
 {
     mword set_as_del = 0;
     Crd crd = s_ti.crd();
@@ -344,7 +474,15 @@ Xfer Pd::xfer_item (Pd *src_pd, Crd xlt, Crd del, Xfer s_ti)
         set_as_del = 1;
         FALL_THROUGH;
     case Xfer::Kind::DELEGATE:
-        del_crd (src_pd->is_priv && s_ti.from_kern() ? &kern : src_pd, del, crd, s_ti.subspaces(), s_ti.hotspot());
+        if (s_ti.cow_pool()) {
+            don_crd (src_pd->is_priv && s_ti.from_kern() ? &kern : src_pd, del, crd, cleanup, s_ti.hotspot());
+            break;
+        }
+
+        if (not del_crd (src_pd->is_priv && s_ti.from_kern() ? &kern : src_pd, del, crd, cleanup, s_ti.subspaces(),
+                         s_ti.hotspot(), s_ti.copy_on_write(), s_ti.share()) and out_of_memory) {
+            *out_of_memory = true;
+        }
         break;
 
     default:
@@ -357,13 +495,19 @@ Xfer Pd::xfer_item (Pd *src_pd, Crd xlt, Crd del, Xfer s_ti)
 
 void Pd::xfer_items (Pd *src_pd, Crd xlt, Crd del, Xfer *s_ti, Xfer *d_ti, unsigned long num_typed)
 {
+    // All items share one shootdown, instead of interrupting the same CPUs
+    // once per item.
+    Tlb_cleanup cleanup;
+
     for (unsigned long cur = 0; cur < num_typed; cur++) {
-        Xfer res {xfer_item (src_pd, xlt, del, *(s_ti - cur))};
+        Xfer res {xfer_item (src_pd, xlt, del, *(s_ti - cur), cleanup)};
 
         if (d_ti) {
             *(d_ti - cur) = res;
         }
     }
+
+    tlb_shootdown (cleanup);
 }
 
 void *Pd::get_access_page()
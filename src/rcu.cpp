@@ -85,14 +85,15 @@ void Rcu::update()
         start_batch (RCU_PND);
     }
 
-    if (!curr().empty() && !next().empty() && (next().count > 2000 || curr().count > 2000))
-        for (unsigned cpu = 0; cpu < NUM_CPU; cpu++) {
+    if (!curr().empty() && !next().empty() && (next().count > 2000 || curr().count > 2000)) {
+        Cpuset cpus;
 
-            if (!Hip::cpu_online (cpu) || Cpu::id() == cpu)
-                continue;
+        for (unsigned cpu = 0; cpu < NUM_CPU; cpu++)
+            if (Hip::cpu_online (cpu) && Cpu::id() != cpu)
+                cpus.set (cpu);
 
-            Lapic::send_ipi (cpu, VEC_IPI_IDL);
-        }
+        Lapic::send_ipi (cpus, VEC_IPI_IDL);
+    }
 
     if (!done().empty())
         invoke_batch();
@@ -189,15 +189,14 @@ void Sc::rke_handler()
 
     Atomic::add (Counter::tlb_shootdown(), static_cast<uint32>(1));
 
-    // In case of host TLB invalidations, we need to enforce that we go through
-    // the scheduler, because there we call Pd::make_current, which performs the
-    // invalidation. Otherwise, we would re-enter userspace directly from the
-    // interrupt handler.
+    // Host TLB entries are invalidated right here, because the current PD
+    // stays current and only its stale entries have to go. There is no need
+    // to go through the scheduler.
     //
     // For guest TLB invalidations, there is no need to go through the
-    // scheduler, because ret_user_vmresume / ret_user_vmrun will take care of
-    // guest TLB invalidations unconditionally.
+    // scheduler either, because ret_user_vmresume / ret_user_vmrun will take
+    // care of guest TLB invalidations unconditionally.
 
     if (Pd::current()->Space_mem::stale_host_tlb.chk (Cpu::id()))
-        Cpu::hazard() |= HZD_SCHED;
+        Pd::current()->make_current();
 }
@@ -22,29 +22,123 @@
 #include "lock_guard.hpp"
 #include "math.hpp"
 #include "mdb.hpp"
+#include "rcu.hpp"
+#include "util.hpp"
+#include "x86.hpp"
 
+struct Space::Node_alloc::Rcu_node
+{
+    Radix_tree<Mdb, Node_alloc>::Node node {};
+    Rcu_elem                          rcu  {free_rcu};
+};
+
+INIT_PRIORITY (PRIO_SLAB)
+Slab_cache Space::Node_alloc::cache (sizeof (Rcu_node), 64);
+
+void *Space::Node_alloc::alloc()
+{
+    return &(new (cache.alloc (Buddy::NOFILL)) Rcu_node)->node;
+}
+
+void Space::Node_alloc::free (void *node)
+{
+    cache.free (node);
+}
+
+void Space::Node_alloc::free_deferred (void *node)
+{
+    Rcu::call (&static_cast<Rcu_node *>(node)->rcu);
+}
+
+void Space::Node_alloc::free_rcu (Rcu_elem *e)
+{
+    cache.free (reinterpret_cast<char *>(e) - OFFSETOF (Rcu_node, rcu));
+}
+
+// Lookups run concurrently with changes to the tree. Mapping database nodes
+// and tree nodes stay valid until the end of the RCU grace period after their
+// removal, so a lookup never touches freed memory. It may see a partial change
+// though. Such lookups are repeated.
 Mdb *Space::tree_lookup (mword idx, bool next)
 {
-    Lock_guard <Spinlock> guard (lock);
-    return Mdb::lookup (tree, idx, next);
+    for (;;) {
+        mword const s {Atomic::load (seq)};
+
+        if (s & 1) {
+            pause();
+            continue;
+        }
+
+        Mdb *m {tree.lookup (idx, next)};
+
+        if (Atomic::load (seq) == s)
+            return m;
+    }
+}
+
+// The cursor continues from its last position as long as the tree did not
+// change. Otherwise, it descends again from the root.
+Mdb *Space::Cursor::next()
+{
+    if (pos.end())
+        return nullptr;
+
+    mword const key {pos.key()};
+
+    for (;;) {
+        mword const s {Atomic::load (space.seq)};
+
+        if (s & 1) {
+            pause();
+            continue;
+        }
+
+        Mdb *m {s == seq ? space.tree.next (pos) : space.tree.seek (pos)};
+
+        if (Atomic::load (space.seq) == s) {
+            seq = s;
+            return m;
+        }
+
+        pos = decltype (pos) (key);
+        seq = 1;
+    }
 }
 
 bool Space::tree_insert (Mdb *node)
 {
-    Lock_guard <Spinlock> guard (node->space->lock);
-    return Mdb::insert<Mdb> (&node->space->tree, node);
+    Space *s {node->space};
+
+    Lock_guard <Spinlock> guard (s->lock);
+
+    s->tree_changing();
+    bool const inserted {s->tree.insert (node)};
+    s->tree_changing();
+
+    return inserted;
 }
 
 bool Space::tree_remove (Mdb *node)
 {
-    Lock_guard <Spinlock> guard (node->space->lock);
-    return Mdb::remove<Mdb> (&node->space->tree, node);
+    Space *s {node->space};
+
+    Lock_guard <Spinlock> guard (s->lock);
+
+    s->tree_changing();
+    bool const removed {s->tree.remove (node)};
+    s->tree_changing();
+
+    return removed;
 }
 
 void Space::addreg (mword addr, size_t size, mword attr, mword type)
 {
     Lock_guard <Spinlock> guard (lock);
 
+    tree_changing();
+
     for (mword o; size; size -= 1UL << o, addr += 1UL << o)
-        Mdb::insert<Mdb> (&tree, new Mdb (nullptr, addr, addr, (o = max_order (addr, size)), attr, type));
+        tree.insert (new Mdb (nullptr, addr, addr, (o = max_order (addr, size)), attr, type));
+
+    tree_changing();
 }
@@ -24,14 +24,25 @@
 #include "hip.hpp"
 #include "lapic.hpp"
 #include "lock_guard.hpp"
+#include "mem_protect.hpp"
 #include "mtrr.hpp"
+#include "nodestruct.hpp"
 #include "pd.hpp"
 #include "space.hpp"
 #include "stdio.hpp"
+#include "string.hpp"
 #include "svm.hpp"
 #include "vectors.hpp"
 
 unsigned Space_mem::did_ctr;
+uint64   Space_mem::generation_ctr;
+
+Space_mem::Phys_db &Space_mem::phys_db()
+{
+    static No_destruct<Phys_db> phys_db {1ULL << PHYS_BITS};
+
+    return *&phys_db;
+}
 
 void Space_mem::init (unsigned cpu)
 {
@@ -46,12 +57,39 @@ static bool is_valid_user_mapping (mword vaddr, mword ord)
         and (vaddr & ((1UL << ord) - 1)) == 0;
 }
 
+// Return the largest naturally aligned region of physical memory around phys
+// that has uniform attributes as a mapping.
+static Hpt::Mapping lookup_phys_db (mword phys)
+{
+    if (phys >= 1ULL << Space_mem::PHYS_BITS) {
+        return {phys, 0, 0, PAGE_BITS};
+    }
+
+    auto const range {Space_mem::phys_db().lookup (phys)};
+    Hpt::ord_t order {PAGE_BITS};
+
+    for (Hpt::ord_t o {order + 1}; o <= static_cast<Hpt::ord_t>(Space_mem::PHYS_BITS); o++) {
+        mword const base {align_dn (phys, 1UL << o)};
+
+        if (base < range.start or base + (1UL << o) > range.end) {
+            break;
+        }
+
+        order = o;
+    }
+
+    mword const base {align_dn (phys, 1UL << order)};
+
+    return {base, range.value ? base : 0, range.value, order};
+}
+
 // Find the source mapping at snd_cur in the given position.
 static Hpt::Mapping lookup_and_adjust_rights (Space_mem *snd, mword snd_cur, mword snd_end, mword hw_attr)
 {
     bool const is_unmap {(hw_attr & Hpt::PTE_P) == 0};
     Hpt::Mapping const empty_mapping {snd_cur, 0, 0, static_cast<Hpt::ord_t>(max_order (snd_cur, snd_end))};
-    Hpt::Mapping mapping {is_unmap ? empty_mapping : snd->Space_mem::hpt.lookup (snd_cur)};
+    Hpt::Mapping mapping {is_unmap ? empty_mapping :
+                          snd == &Pd::kern ? lookup_phys_db (snd_cur) : snd->Space_mem::hpt.lookup (snd_cur)};
 
     if (mapping.present() and ((mapping.attr & Hpt::PTE_NODELEG) or not (mapping.attr & Hpt::PTE_U))) {
         trace (TRACE_ERROR, "Refusing to map region %#016lx ord %d", mapping.vaddr, mapping.order);
@@ -62,23 +100,106 @@ static Hpt::Mapping lookup_and_adjust_rights (Space_mem *snd, mword snd_cur, mwo
     return mapping;
 }
 
-// Addresses are in byte-granularity.
-Tlb_cleanup Space_mem::delegate (Space_mem *snd, mword snd_base, mword rcv_base, mword ord, mword attr, mword sub)
+// Share the host page tables of snd that translate the region at snd_cur
+// with dst instead of copying their entries. Returns the size of the shared
+// region or zero, if there is no page table that can be shared.
+static mword share_page_tables (Tlb_cleanup &cleanup, Hpt &dst, Space_mem *snd, mword snd_cur, mword rcv_cur,
+                                mword snd_end)
 {
-    Tlb_cleanup cleanup;
+    // Only entries that could be delegated one by one can be shared.
+    auto const delegatable {[] (Hpt::pte_t a) { return (a & Hpt::PTE_U) and not (a & Hpt::PTE_NODELEG); }};
+
+    // Try 1 GiB regions first, then 2 MiB regions.
+    Hpt::ord_t const orders[] {PAGE_BITS + 2 * 9, PAGE_BITS + 9};
+
+    for (Hpt::ord_t const order : orders) {
+        if (is_aligned_by_order (snd_cur, order) and is_aligned_by_order (rcv_cur, order) and
+            snd_end - snd_cur >= (1UL << order) and
+            dst.share_from (cleanup, snd->hpt, snd_cur, rcv_cur, order, delegatable)) {
+            return 1UL << order;
+        }
+    }
+
+    return 0;
+}
+
+bool Space_mem::reserve_tables (Hpt::Mapping const &m, mword sub, Dpt::Page_pool &dpt_pool, Ept::Page_pool &ept_pool,
+                                Hpt::Page_pool &hpt_pool)
+{
+    bool const device {(sub & Space::SUBSPACE_DEVICE) and not dma_uses_ept};
+    bool const guest  {(sub & Space::SUBSPACE_GUEST) != 0};
+    bool const host   {(sub & Space::SUBSPACE_HOST) != 0};
+
+    // The npt and the hpt share a pool.
+    size_t const hpt_tables {(guest and Vmcb::has_npt() ? npt.max_new_tables (m) : 0) +
+                             (host ? hpt.max_new_tables (m) : 0)};
 
+    return (not device or dpt.reserve (dpt_pool, dpt.max_new_tables (Dpt::convert_mapping (m)))) and
+           (not guest or Vmcb::has_npt() or ept.reserve (ept_pool, ept.max_new_tables (Ept::convert_mapping (m)))) and
+           hpt.reserve (hpt_pool, hpt_tables);
+}
+
+// Addresses are in byte-granularity.
+bool Space_mem::delegate (Tlb_cleanup &cleanup, Space_mem *snd, mword snd_base, mword rcv_base, mword ord, mword attr,
+                          mword sub, bool share)
+{
     assert (ord >= PAGE_BITS);
 
     if (EXPECT_FALSE (not is_valid_user_mapping (snd_base, ord) or
                       not is_valid_user_mapping (rcv_base, ord))) {
         trace (TRACE_ERROR, "INVALID MEM SB:%#016lx RB:%#016lx O:%#04lx A:%#lx S:%#lx", snd_base, rcv_base, ord, attr, sub);
-        return cleanup;
+        return true;
+    }
+
+    // The ept also translates DMA. Any update to it has to be visible to
+    // both, so both TLBs and IOTLBs have to be invalidated.
+    if (dma_uses_ept and (sub & (Space::SUBSPACE_DEVICE | Space::SUBSPACE_GUEST))) {
+        sub |= Space::SUBSPACE_DEVICE | Space::SUBSPACE_GUEST;
     }
 
     Hpt::pte_t const hw_attr {Hpt::hw_attr (attr)};
     mword      const snd_end {snd_base + (1ULL << ord)};
 
+    // Page tables can only be shared, if the receiver gets exactly the
+    // entries of the sender and all destination page tables are host page
+    // tables.
+    bool const all_rights {(attr & (Mdb::MEM_R | Mdb::MEM_W | Mdb::MEM_X)) == (Mdb::MEM_R | Mdb::MEM_W | Mdb::MEM_X)};
+    bool const hpt_format {not (sub & Space::SUBSPACE_DEVICE) and (Vmcb::has_npt() or not (sub & Space::SUBSPACE_GUEST))};
+
+    share = share and all_rights and hpt_format and snd != &Pd::kern;
+
+    // The page tables for all subspaces are reserved before any of them is
+    // updated, so running out of memory leaves the chunk untouched.
+    // Leftover pages are reused by the next chunk and released in bulk at
+    // the end.
+    Dpt::Page_pool dpt_pool;
+    Ept::Page_pool ept_pool;
+    Hpt::Page_pool hpt_pool;
+
+    bool const device {(sub & Space::SUBSPACE_DEVICE) and not dma_uses_ept};
+    bool const guest  {(sub & Space::SUBSPACE_GUEST) != 0};
+    bool const host   {(sub & Space::SUBSPACE_HOST) != 0};
+
+    bool complete {true};
+
     for (mword snd_cur {snd_base}; snd_cur < snd_end;) {
+        if (share) {
+            mword const rcv_cur {snd_cur - snd_base + rcv_base};
+
+            mword const host_size  {host ? share_page_tables (cleanup, hpt, snd, snd_cur, rcv_cur, snd_end) : 0};
+            mword const guest_size {guest and (host_size != 0 or not host) ?
+                                    share_page_tables (cleanup, npt, snd, snd_cur, rcv_cur, snd_end) : 0};
+
+            // If only one of them could be shared, the region is mapped as
+            // usual below, which replaces the shared page tables again.
+            mword const shared_size {host and guest ? (host_size == guest_size ? host_size : 0) : host_size | guest_size};
+
+            if (shared_size != 0) {
+                snd_cur += shared_size;
+                continue;
+            }
+        }
+
         // The source mapping with the correct downgraded rights.
         auto const mapping {lookup_and_adjust_rights (snd, snd_cur, snd_end, hw_attr)};
 
@@ -89,8 +210,18 @@ Tlb_cleanup Space_mem::delegate (Space_mem *snd, mword snd_base, mword rcv_base,
         auto const target_mapping {clamped.move_by (rcv_base - snd_base)};
         assert (Hpt::attr_to_pat (target_mapping.attr) == 0);
 
+        // Unmapping must not fail, so the page tables for splitting
+        // superpages are allocated on demand instead.
+        if (not reserve_tables (target_mapping, sub, dpt_pool, ept_pool, hpt_pool) and target_mapping.present()) {
+            trace (TRACE_ERROR, "Out of memory for page tables SB:%#016lx RB:%#016lx O:%#04lx", snd_base, rcv_base, ord);
+            complete = false;
+            break;
+        }
+
         if (sub & Space::SUBSPACE_DEVICE) {
-            dpt.update (cleanup, Dpt::convert_mapping (target_mapping));
+            if (device) {
+                dpt.update (cleanup, Dpt::convert_mapping (target_mapping), &dpt_pool);
+            }
 
             // We would only want to call `cleanup.flush_tlb_later();` explicitly if the Caching
             // Mode of the IOMMU is set to 1, which implies that even non-present and erroneus
@@ -100,45 +231,296 @@ Tlb_cleanup Space_mem::delegate (Space_mem *snd, mword snd_base, mword rcv_base,
             cleanup.flush_tlb_later();
         }
 
-        if (sub & Space::SUBSPACE_GUEST) {
+        if (guest) {
             if (Vmcb::has_npt()) {
-                npt.update (cleanup, target_mapping);
+                npt.update (cleanup, target_mapping, &hpt_pool);
             } else {
-                ept.update (cleanup, Ept::convert_mapping (target_mapping));
+                ept.update (cleanup, Ept::convert_mapping (target_mapping), &ept_pool);
             }
         }
 
-        if (sub & Space::SUBSPACE_HOST) {
-            hpt.update (cleanup, target_mapping);
+        if (host) {
+            hpt.update (cleanup, target_mapping, &hpt_pool);
         }
 
         assert (clamped.size() >= target_mapping.size());
         snd_cur = clamped.vaddr + target_mapping.size();
     }
 
+    dpt.release (dpt_pool);
+    ept.release (ept_pool);
+    hpt.release (hpt_pool);
+
     if (cleanup.need_tlb_flush()) {
         if (sub & Space::SUBSPACE_DEVICE) { Dmar::flush_all_contexts(); }
         if (sub & Space::SUBSPACE_GUEST) { stale_guest_tlb.merge (cpus); }
-        if (sub & Space::SUBSPACE_HOST)  { stale_host_tlb.merge (cpus); }
+        if (sub & Space::SUBSPACE_HOST)  { mark_stale_host_tlb (cleanup); }
+    }
+
+    return complete;
+}
+
+Tlb_cleanup Space_mem::revoke (mword vaddr, mword ord, mword attr, bool cow)
+{
+    auto const all_subspaces {Space::SUBSPACE_HOST | Space::SUBSPACE_DEVICE | Space::SUBSPACE_GUEST};
+
+    Tlb_cleanup cleanup;
+
+    // A mapping without read access is not a mapping anymore. Unmapping
+    // cannot run out of memory.
+    if (attr & Mdb::MEM_R) {
+        [[maybe_unused]] bool const complete {delegate (cleanup, this, vaddr, vaddr, ord, 0, all_subspaces)};
+        assert (complete);
+
+        return cleanup;
+    }
+
+    if (EXPECT_FALSE (not is_valid_user_mapping (vaddr, ord))) {
+        trace (TRACE_ERROR, "INVALID MEM REVOKE B:%#016lx O:%#04lx A:%#lx", vaddr, ord, attr);
+        return cleanup;
+    }
+
+    bool const no_w {(attr & Mdb::MEM_W) != 0};
+    bool const no_x {(attr & Mdb::MEM_X) != 0};
+
+    if (not no_w and not no_x) {
+        return cleanup;
+    }
+
+    // The remaining rights are downgraded in place, so the page tables keep
+    // their superpages and the mappings do not have to be faulted back in.
+    bool const has_npt {Vmcb::has_npt()};
+
+    protect_subspaces (cleanup, vaddr, static_cast<Hpt::ord_t>(ord), no_w, no_x, cow, hpt,
+                       has_npt ? &npt : nullptr, has_npt ? nullptr : &ept, dma_uses_ept ? nullptr : &dpt);
+
+    if (cleanup.need_tlb_flush()) {
+        Dmar::flush_all_contexts();
+        stale_guest_tlb.merge (cpus);
+        mark_stale_host_tlb (cleanup);
     }
 
     return cleanup;
 }
 
-Tlb_cleanup Space_mem::revoke (mword vaddr, mword ord, mword attr)
+void Space_mem::donate (Tlb_cleanup &cleanup, Space_mem *snd, mword snd_base, mword ord)
 {
-    auto const all_mem_rights {Mdb::MEM_R | Mdb::MEM_W | Mdb::MEM_X};
+    if (EXPECT_FALSE (not is_valid_user_mapping (snd_base, ord))) {
+        trace (TRACE_ERROR, "INVALID MEM DONATION SB:%#016lx O:%#04lx", snd_base, ord);
+        return;
+    }
+
+    Hpt::pte_t const hw_attr {Hpt::hw_attr (Mdb::MEM_R | Mdb::MEM_W)};
+    mword      const snd_end {snd_base + (1UL << ord)};
+    uint64           pages   {0};
 
-    if ((attr & all_mem_rights) != all_mem_rights) {
-        trace (TRACE_ERROR, "Partial memory rights revocation is not supported: Revoking everything! (%#lx %ld %#lx)",
-               vaddr, ord, attr);
+    for (mword snd_cur {snd_base}; snd_cur < snd_end;) {
+        auto const mapping {lookup_and_adjust_rights (snd, snd_cur, snd_end, hw_attr)};
+        auto const clamped {mapping.clamp (snd_base, static_cast<Hpt::ord_t>(ord))};
+
+        if (clamped.present() and (clamped.attr & Hpt::PTE_W)) {
+            pages += clamped.size() / PAGE_SIZE;
+        }
+
+        snd_cur = clamped.vaddr + clamped.size();
+    }
+
+    // The copies are not taken from the donated memory, because we can't
+    // tell who else maps it. The sender pays for them by giving it up.
+    if (snd != &Pd::kern) {
+        cleanup.merge (snd->revoke (snd_base, ord, Mdb::MEM_R));
     }
 
-    return delegate (this, vaddr, vaddr, ord, 0, Space::SUBSPACE_HOST | Space::SUBSPACE_DEVICE | Space::SUBSPACE_GUEST);
+    Lock_guard <Spinlock> guard (cow_lock);
+
+    cow_pool.add (pages);
+}
+
+bool Space_mem::resolve_cow (mword vaddr, bool guest_fault, Tlb_cleanup &cleanup)
+{
+    mword const page {align_dn (vaddr, PAGE_SIZE)};
+    bool  const has_npt {Vmcb::has_npt()};
+
+    // Concurrent faults on the same page must not copy it twice, because
+    // the first copy may already have been written to.
+    Lock_guard <Spinlock> guard (cow_lock);
+
+    Hpt::Mapping const host   {hpt.lookup (page)};
+    Hpt::Mapping const nested {has_npt ? npt.lookup (page) : Hpt::Mapping {}};
+    Ept::Mapping const guest  {has_npt ? Ept::Mapping {} : ept.lookup (page)};
+    Dpt::Mapping const device {dma_uses_ept ? Dpt::Mapping {} : dpt.lookup (page)};
+
+    // The faulting subspace decides whether this is a copy-on-write fault.
+    bool  present, writable, cow;
+    Paddr old_phys;
+
+    if (guest_fault and not has_npt) {
+        present  = guest.present();
+        writable = guest.attr & Ept::PTE_W;
+        cow      = guest.attr & Ept::PTE_COW;
+        old_phys = guest.paddr + (page - guest.vaddr);
+    } else {
+        Hpt::Mapping const &m {guest_fault ? nested : host};
+
+        present  = m.present();
+        writable = m.attr & Hpt::PTE_W;
+        cow      = m.attr & Hpt::PTE_COW;
+        old_phys = m.paddr + (page - m.vaddr);
+    }
+
+    if (not present or not cow) {
+        return present and writable;
+    }
+
+    // Only the subspaces that still map the original page get the copy.
+    // Each of them keeps its own attributes.
+    auto const original_attr {[old_phys, page] (auto const &m) {
+        return m.present() and m.paddr + (page - m.vaddr) == old_phys ? m.attr : 0;
+    }};
+
+    return copy_cow_page (cleanup, page, old_phys, original_attr (host), original_attr (nested),
+                          original_attr (guest), original_attr (device));
+}
+
+bool Space_mem::copy_cow_page (Tlb_cleanup &cleanup, mword page, Paddr old_phys, Hpt::pte_t host_attr,
+                               Hpt::pte_t nested_attr, Ept::pte_t guest_attr, Dpt::pte_t device_attr)
+{
+    bool const in_guest {(nested_attr | guest_attr) != 0};
+
+    mword sub {0};
+
+    if (host_attr)   { sub |= Space::SUBSPACE_HOST; }
+    if (in_guest)    { sub |= Space::SUBSPACE_GUEST; }
+    if (device_attr) { sub |= Space::SUBSPACE_DEVICE; }
+
+    // The ept also translates DMA (see delegate).
+    if (in_guest and dma_uses_ept) { sub |= Space::SUBSPACE_DEVICE; }
+
+    // The page tables only depend on the address of the copy, so they are
+    // reserved before taking a page from the pool.
+    Dpt::Page_pool dpt_pool;
+    Ept::Page_pool ept_pool;
+    Hpt::Page_pool hpt_pool;
+
+    uint64 new_phys;
+
+    if (not reserve_tables ({page, 0, Hpt::PTE_P | Hpt::PTE_U, PAGE_BITS}, sub, dpt_pool, ept_pool, hpt_pool) or
+        not cow_pool.take (new_phys)) {
+        dpt.release (dpt_pool);
+        ept.release (ept_pool);
+        hpt.release (hpt_pool);
+
+        return false;
+    }
+
+    // Faults are resolved without any other temporary mappings.
+    assert (Hpt::remap_available() >= 2);
+
+    {
+        auto const src {Hpt::remap (old_phys)};
+        auto const dst {Hpt::remap (new_phys)};
+
+        memcpy (dst.get(), src.get(), PAGE_SIZE);
+    }
+
+    // The copy belongs to the pool and is freed with this memory space, so
+    // the host mapping must not be delegated.
+    if (host_attr) {
+        hpt.update (cleanup, {page, new_phys, (host_attr | Hpt::PTE_W | Hpt::PTE_NODELEG) & ~Hpt::PTE_COW, PAGE_BITS},
+                    &hpt_pool);
+    }
+
+    if (nested_attr) {
+        npt.update (cleanup, {page, new_phys, (nested_attr | Hpt::PTE_W) & ~Hpt::PTE_COW, PAGE_BITS}, &hpt_pool);
+    }
+
+    if (guest_attr) {
+        ept.update (cleanup, {page, new_phys, (guest_attr | Ept::PTE_W) & ~Ept::PTE_COW, PAGE_BITS}, &ept_pool);
+    }
+
+    if (device_attr) {
+        dpt.update (cleanup, {page, new_phys, device_attr | Dpt::PTE_W, PAGE_BITS}, &dpt_pool);
+    }
+
+    dpt.release (dpt_pool);
+    ept.release (ept_pool);
+    hpt.release (hpt_pool);
+
+    if (cleanup.need_tlb_flush()) {
+        if (sub & Space::SUBSPACE_DEVICE) { Dmar::flush_all_contexts(); }
+        if (sub & Space::SUBSPACE_GUEST) { stale_guest_tlb.merge (cpus); }
+        mark_stale_host_tlb (cleanup);
+    }
+
+    return true;
+}
+
+void Space_mem::mark_stale_host_tlb (Tlb_cleanup const &cleanup)
+{
+    {
+        Lock_guard <Spinlock> guard (stale_host_lock);
+
+        stale_host_ranges.add (cleanup.tlb_ranges());
+        stale_host_range_cpus.merge (active);
+    }
+
+    // Only now may the CPUs pick up the ranges.
+    stale_host_tlb.merge (active);
+}
+
+void Space_mem::take_stale_host_tlb (Tlb_ranges &ranges)
+{
+    unsigned const cpu {Cpu::id()};
+
+    Lock_guard <Spinlock> guard (stale_host_lock);
+
+    // We already took the ranges together with an earlier flush. This is a
+    // rare race, so we do not try to be clever.
+    if (not stale_host_range_cpus.chk (cpu)) {
+        ranges.add_all();
+        return;
+    }
+
+    ranges.add (stale_host_ranges);
+    stale_host_range_cpus.clr (cpu);
+
+    if (stale_host_range_cpus.empty()) {
+        stale_host_ranges.clear();
+    }
+}
+
+void Space_mem::tlb_dropped()
+{
+    unsigned const cpu {Cpu::id()};
+
+    active.clr (cpu);
+
+    // Whatever was stale is gone as well.
+    if (stale_host_tlb.chk (cpu)) {
+        Tlb_ranges ranges;
+
+        stale_host_tlb.clr (cpu);
+        take_stale_host_tlb (ranges);
+    }
+}
+
+long Space_mem::guest_table_pages() const
+{
+    return Vmcb::has_npt() ? npt.table_pages() : ept.table_pages();
 }
 
 void Space_mem::shootdown()
 {
+    // The counter values of all CPUs we sent an IPI to. A CPU has acknowledged
+    // the shootdown, once its counter differs from the recorded value.
+    auto &ctr = Cpulocal::get().shootdown_ctr;
+    Cpuset pending;
+    unsigned outstanding = 0;
+
+    uint64 const start = rdtsc();
+
+    // Collect all targets first and send the IPIs at once, so the remote CPUs
+    // handle them in parallel instead of one after another.
     for (unsigned cpu = 0; cpu < NUM_CPU; cpu++) {
 
         if (!Hip::cpu_online (cpu))
@@ -149,41 +531,58 @@ void Space_mem::shootdown()
         if (!pd->stale_host_tlb.chk (cpu) && !pd->stale_guest_tlb.chk (cpu))
             continue;
 
+        // Stale guest TLB entries are invalidated on the next VM entry.
         if (Cpu::id() == cpu) {
-            Cpu::hazard() |= HZD_SCHED;
+            if (pd->stale_host_tlb.chk (cpu)) {
+                pd->make_current();
+            }
+
             continue;
         }
 
-        unsigned ctr = Counter::remote_tlb_shootdown (cpu);
+        ctr[cpu] = Counter::remote_tlb_shootdown (cpu);
+        pending.set (cpu);
+        outstanding++;
+
+        Atomic::add (pd->tlb_stats.shootdown_ipis, static_cast<mword>(1));
+    }
 
-        Lapic::send_ipi (cpu, VEC_IPI_RKE);
+    if (!outstanding)
+        return;
 
-        if (!Cpu::preempt_enabled())
-            asm volatile ("sti" : : : "memory");
+    Counter::shootdown_ipis() += outstanding;
 
-        while (Counter::remote_tlb_shootdown (cpu) == ctr)
-            pause();
+    Lapic::send_ipi (pending, VEC_IPI_RKE);
 
-        if (!Cpu::preempt_enabled())
-            asm volatile ("cli" : : : "memory");
-    }
-}
+    if (!Cpu::preempt_enabled())
+        asm volatile ("sti" : : : "memory");
 
-static void map_typed_range (Hpt &hpt, Paddr start, Paddr end, Hpt::pte_t attr, unsigned t)
-{
-    assert ((t    & ~Hpt::MT_MASK)     == 0);
-    assert ((attr &  Hpt::PTE_MT_MASK) == 0);
+    while (outstanding) {
+        for (unsigned cpu = 0; cpu < NUM_CPU; cpu++) {
+            if (pending.chk (cpu) and Counter::remote_tlb_shootdown (cpu) != ctr[cpu]) {
+                pending.clr (cpu);
+                outstanding--;
+            }
+        }
+
+        if (outstanding)
+            pause();
+    }
 
-    Hpt::pte_t const combined_attr {attr | (static_cast<Hpt::pte_t>(t) << Hpt::PTE_MT_SHIFT)};
-    Paddr size;
+    if (!Cpu::preempt_enabled())
+        asm volatile ("cli" : : : "memory");
 
-    for (Paddr cur {start}; cur < end; cur += size) {
-        auto order {min<Hpt::ord_t> (hpt.max_order(), static_cast<Hpt::ord_t> (max_order (cur, end - cur)))};
-        assert (order >= PAGE_BITS);
+    uint64 const cycles = rdtsc() - start;
 
-        size = static_cast<Paddr>(1) << order;
+    Counter::shootdowns()++;
+    Counter::shootdown_cycles() += cycles;
+    Counter::shootdown_max_cycles() = max (Counter::shootdown_max_cycles(), cycles);
+}
 
-        hpt.update ({cur, cur, combined_attr, order}).ignore_tlb_flush();
+static void set_phys_db (Paddr start, Paddr end, Hpt::pte_t attr)
+{
+    if (not Space_mem::phys_db().set (start, end, attr)) {
+        Console::panic ("Physical memory database is full");
     }
 }
 
@@ -197,13 +596,17 @@ void Space_mem::insert_root (uint64 start, uint64 end, mword attr)
     for (Paddr cur {start}; cur < end;) {
         uint64 next;
         unsigned t = Mtrr_state::get().memtype (cur, next);
+        Hpt::pte_t const hw_attr {Hpt::hw_attr (attr)};
+
+        assert ((t & ~Hpt::MT_MASK) == 0 and (hw_attr & Hpt::PTE_MT_MASK) == 0);
 
-        map_typed_range (hpt, cur, min <uint64> (next, end), Hpt::hw_attr (attr), t);
+        next = min<uint64> (next, end);
+        set_phys_db (cur, next, hw_attr | (static_cast<Hpt::pte_t>(t) << Hpt::PTE_MT_SHIFT));
         cur = next;
     }
 }
 
-void Space_mem::claim (mword virt, unsigned o, mword attr, Paddr phys, bool exclusive)
+void Space_mem::claim (mword virt, unsigned o, mword attr, Paddr phys)
 {
     assert (static_cast<Pd *>(this) == &Pd::kern);
     assert (&Hpt::boot_hpt() != &hpt);
@@ -212,13 +615,9 @@ void Space_mem::claim (mword virt, unsigned o, mword attr, Paddr phys, bool excl
     assert (o >= PAGE_BITS);
 
     Hpt::boot_hpt().update ({virt, phys, attr, static_cast<Hpt::ord_t>(o)});
-
-    if (exclusive) {
-        hpt.update ({virt, phys, 0, static_cast<Hpt::ord_t>(o)});
-    }
 }
 
-void Space_mem::claim_mmio_page (mword virt, Paddr phys, bool exclusive)
+void Space_mem::claim_mmio_page (mword virt, Paddr phys)
 {
-    claim (virt, PAGE_BITS, Hpt::PTE_NX | Hpt::PTE_G | Hpt::PTE_UC | Hpt::PTE_W | Hpt::PTE_P, phys, exclusive);
+    claim (virt, PAGE_BITS, Hpt::PTE_NX | Hpt::PTE_G | Hpt::PTE_UC | Hpt::PTE_W | Hpt::PTE_P, phys);
 }
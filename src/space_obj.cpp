@@ -66,7 +66,7 @@ size_t Space_obj::lookup (mword idx, Capability &cap)
 Tlb_cleanup Space_obj::update (Mdb *mdb, mword r)
 {
     assert (this == mdb->space && this != &Pd::kern);
-    Lock_guard <Spinlock> guard (mdb->node_lock);
+    Lock_guard <Spinlock> guard (mdb->derivation_lock());
     return update (mdb->node_base, Capability (reinterpret_cast<Kobject *>(mdb->node_phys), mdb->node_attr & ~r));
 }
 
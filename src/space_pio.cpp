@@ -40,30 +40,26 @@ Paddr Space_pio::walk (bool host, mword idx)
     return bmp | (idx_to_virt (idx) & (2 * PAGE_SIZE - 1));
 }
 
-void Space_pio::update (bool host, mword idx, mword attr)
+void Space_pio::update (bool host, mword idx, mword order, mword attr)
 {
-    mword *m = static_cast<mword *>(Buddy::phys_to_ptr (walk (host, idx)));
+    Io_bitmap *bmp = static_cast<Io_bitmap *>(Buddy::phys_to_ptr (walk (host)));
 
-    if (attr)
-        Atomic::clr_mask (*m, idx_to_mask (idx));
-    else
-        Atomic::set_mask (*m, idx_to_mask (idx));
+    // Set bits deny access to a port.
+    bmp->atomic_set_range (idx, 1UL << order, !attr);
 }
 
 Tlb_cleanup Space_pio::update (Mdb *mdb, mword r)
 {
     assert (this == mdb->space && this != &Pd::kern);
 
-    Lock_guard <Spinlock> guard (mdb->node_lock);
+    Lock_guard <Spinlock> guard (mdb->derivation_lock());
 
-    for (unsigned long i = 0; i < (1UL << mdb->node_order); i++) {
-        if (mdb->node_sub & SUBSPACE_HOST) {
-            update (true, mdb->node_base + i, mdb->node_attr & ~r);
-        }
+    if (mdb->node_sub & SUBSPACE_HOST) {
+        update (true, mdb->node_base, mdb->node_order, mdb->node_attr & ~r);
+    }
 
-        if (mdb->node_sub & SUBSPACE_GUEST) {
-            update (false, mdb->node_base + i, mdb->node_attr & ~r);
-        }
+    if (mdb->node_sub & SUBSPACE_GUEST) {
+        update (false, mdb->node_base, mdb->node_order, mdb->node_attr & ~r);
     }
 
     return {};
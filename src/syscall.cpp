@@ -257,8 +257,14 @@ void Ec::sys_create_pd()
         sys_finish<Sys_regs::BAD_CAP>();
     }
 
+    if (EXPECT_FALSE (r->is_dma_ept() and not Dmar::can_share_ept())) {
+        trace (TRACE_ERROR, "%s: Shared DMA page table not supported", __func__);
+        sys_finish<Sys_regs::BAD_FTR>();
+    }
+
     Pd *pd = new Pd (Pd::current(), r->sel(), parent_pd_cap.prm(),
-                     (r->is_passthrough() and parent_pd->is_passthrough) ? Pd::IS_PASSTHROUGH : 0);
+                     ((r->is_passthrough() and parent_pd->is_passthrough) ? Pd::IS_PASSTHROUGH : 0) |
+                     (r->is_dma_ept() ? Pd::IS_DMA_EPT : 0));
     if (!Space_obj::insert_root (pd)) {
         trace (TRACE_ERROR, "%s: Non-NULL CAP (%#lx)", __func__, r->sel());
         delete pd;
@@ -266,7 +272,10 @@ void Ec::sys_create_pd()
     }
 
     Crd crd = r->crd();
-    pd->del_crd (Pd::current(), Crd (Crd::OBJ), crd);
+    Tlb_cleanup cleanup;
+
+    pd->del_crd (Pd::current(), Crd (Crd::OBJ), crd, cleanup);
+    Pd::tlb_shootdown (cleanup);
 
     sys_finish<Sys_regs::SUCCESS>();
 }
@@ -529,7 +538,15 @@ void Ec::sys_pd_ctrl_delegate()
         sys_finish<Sys_regs::BAD_CAP>();
     }
 
-    s->set_xfer (dst_pd->xfer_item (src_pd, s->dst_crd(), s->dst_crd(), xfer));
+    Tlb_cleanup cleanup;
+    bool out_of_memory {false};
+
+    s->set_xfer (dst_pd->xfer_item (src_pd, s->dst_crd(), s->dst_crd(), xfer, cleanup, &out_of_memory));
+    Pd::tlb_shootdown (cleanup);
+
+    if (EXPECT_FALSE (out_of_memory)) {
+        sys_finish<Sys_regs::BAD_MEM>();
+    }
 
     sys_finish<Sys_regs::SUCCESS>();
 }
@@ -705,6 +722,11 @@ void Ec::sys_assign_gsi()
         sys_finish<Sys_regs::BAD_CPU>();
     }
 
+    if (EXPECT_FALSE (not Gsi::can_target (r->cpu()))) {
+        trace (TRACE_ERROR, "%s: CPU %#x has APIC ID %#x", __func__, r->cpu(), Cpu::apic_id[r->cpu()]);
+        sys_finish<Sys_regs::BAD_CPU>();
+    }
+
     Sm *sm = capability_cast<Sm>(Space_obj::lookup (r->sm()));
 
     if (EXPECT_FALSE (not sm)) {
@@ -765,6 +787,8 @@ void Ec::sys_machine_ctrl()
     switch (r->op()) {
     case Sys_machine_ctrl::SUSPEND: sys_machine_ctrl_suspend();
     case Sys_machine_ctrl::UPDATE_MICROCODE: sys_machine_ctrl_update_microcode();
+    case Sys_machine_ctrl::PAGE_TABLE_STATS: sys_machine_ctrl_page_table_stats();
+    case Sys_machine_ctrl::TLB_STATS: sys_machine_ctrl_tlb_stats();
 
     default:
         sys_finish<Sys_regs::BAD_PAR>();
@@ -801,8 +825,11 @@ void Ec::sys_machine_ctrl_update_microcode()
     // The userspace mapping describes the start of the microcode update BLOB,
     // but the WRMSR instruction expects a pointer to the payload, which starts
     // at offset 48.
-    auto kernel_addr {reinterpret_cast<mword>(Hpt::remap (r->update_address(), false)) + 48};
-    Msr::write_safe(Msr::IA32_BIOS_UPDT_TRIG, kernel_addr);
+    {
+        auto const map {Hpt::remap (r->update_address())};
+        auto kernel_addr {reinterpret_cast<mword>(map.get()) + 48};
+        Msr::write_safe(Msr::IA32_BIOS_UPDT_TRIG, kernel_addr);
+    }
 
     // Microcode loads may expose new CPU features.
     Cpu::update_features();
@@ -810,6 +837,67 @@ void Ec::sys_machine_ctrl_update_microcode()
     sys_finish<Sys_regs::SUCCESS>();
 }
 
+void Ec::sys_machine_ctrl_page_table_stats()
+{
+    Sys_machine_ctrl_page_table_stats *r = static_cast<Sys_machine_ctrl_page_table_stats *>(current()->sys_regs());
+
+    Pd *pd = capability_cast<Pd>(Space_obj::lookup (r->pd()));
+
+    if (EXPECT_FALSE (not pd)) {
+        trace (TRACE_ERROR, "%s: Bad PD CAP (%#lx)", __func__, r->pd());
+        sys_finish<Sys_regs::BAD_CAP>();
+    }
+
+    r->set_table_pages (static_cast<mword>(pd->Space_mem::hpt.table_pages()),
+                        static_cast<mword>(pd->guest_table_pages()),
+                        static_cast<mword>(pd->dpt.table_pages()));
+
+    sys_finish<Sys_regs::SUCCESS>();
+}
+
+void Ec::sys_machine_ctrl_tlb_stats()
+{
+    Sys_machine_ctrl_tlb_stats *r = static_cast<Sys_machine_ctrl_tlb_stats *>(current()->sys_regs());
+
+    if (r->set() == Sys_machine_ctrl_tlb_stats::stats_set::PD) {
+        Pd *pd = capability_cast<Pd>(Space_obj::lookup (r->target()));
+
+        if (EXPECT_FALSE (not pd)) {
+            trace (TRACE_ERROR, "%s: Bad PD CAP (%#lx)", __func__, r->target());
+            sys_finish<Sys_regs::BAD_CAP>();
+        }
+
+        r->set_counters (Atomic::load (pd->tlb_stats.shootdown_ipis), Atomic::load (pd->tlb_stats.flush_full),
+                         Atomic::load (pd->tlb_stats.flush_ranged), Atomic::load (pd->tlb_stats.invept));
+
+        sys_finish<Sys_regs::SUCCESS>();
+    }
+
+    unsigned long const cpu {r->target()};
+
+    if (EXPECT_FALSE (not Hip::cpu_online (cpu))) {
+        trace (TRACE_ERROR, "%s: Invalid CPU (%#lx)", __func__, cpu);
+        sys_finish<Sys_regs::BAD_CPU>();
+    }
+
+    unsigned const c {static_cast<unsigned>(cpu)};
+
+    switch (r->set()) {
+    case Sys_machine_ctrl_tlb_stats::stats_set::CPU_SHOOTDOWN:
+        r->set_counters (Counter::remote_load_shootdowns (c), Counter::remote_load_shootdown_ipis (c),
+                         Counter::remote_load_shootdown_cycles (c), Counter::remote_load_shootdown_max_cycles (c));
+        break;
+    case Sys_machine_ctrl_tlb_stats::stats_set::CPU_FLUSH:
+        r->set_counters (Counter::remote_load_tlb_flush_full (c), Counter::remote_load_tlb_flush_ranged (c),
+                         Counter::remote_load_invept (c), Counter::remote_load_tlb_flush_ignored (c));
+        break;
+    default:
+        sys_finish<Sys_regs::BAD_PAR>();
+    }
+
+    sys_finish<Sys_regs::SUCCESS>();
+}
+
 void Ec::syscall_handler()
 {
     // System call handler functions are all marked noreturn.
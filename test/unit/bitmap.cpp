@@ -161,6 +161,16 @@ TEST_CASE("Bitmap atomic operations work", "[bitmap]")
         CHECK(bitmap[100] == false);
     }
 
+    SECTION("atomic_none works") {
+        CHECK(bitmap.atomic_none());
+
+        bitmap[100] = true;
+        CHECK_FALSE(bitmap.atomic_none());
+
+        bitmap[100] = false;
+        CHECK(bitmap.atomic_none());
+    }
+
     SECTION("atomic_union works") {
         Bitmap<mword, SIZE> empty_bitmap {false};
         Bitmap<mword, SIZE> other_bitmap {false};
@@ -188,3 +198,26 @@ TEST_CASE("Bitmap atomic operations work", "[bitmap]")
         CHECK(std::equal(bitmap.begin(), bitmap.end(), reference.begin(), reference.end()));
     }
 }
+
+TEST_CASE("Bitmap ranges can be set at once", "[bitmap]")
+{
+    constexpr size_t SIZE {256};
+
+    for (bool initial : {false, true}) {
+        for (size_t first : {0, 1, 63, 64, 100, 128}) {
+            for (size_t count : {0, 1, 2, 63, 64, 65, 128}) {
+                if (first + count > SIZE) {
+                    continue;
+                }
+
+                Bitmap<mword, SIZE> bitmap {initial};
+                bitmap.atomic_set_range(first, count, not initial);
+
+                for (size_t i = 0; i < SIZE; i++) {
+                    bool const in_range {i >= first and i < first + count};
+                    CHECK(bitmap[i] == (in_range ? not initial : initial));
+                }
+            }
+        }
+    }
+}
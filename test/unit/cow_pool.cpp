@@ -0,0 +1,106 @@
+/*
+ * Copy-on-write page pool tests
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#include <cow_pool.hpp>
+
+#include <catch2/catch.hpp>
+
+#include <cstdlib>
+#include <set>
+
+namespace {
+
+// Kernel pages from the heap, whose physical address is their virtual one.
+struct Heap_page_alloc
+{
+    using pointer = mword *;
+
+    static inline int allocated {0};
+    static inline int limit {1000};
+
+    static pointer try_alloc_zeroed_page()
+    {
+        if (allocated == limit) {
+            return nullptr;
+        }
+
+        allocated++;
+        return static_cast<pointer>(calloc (1, PAGE_SIZE));
+    }
+
+    static void free_page (pointer p)
+    {
+        allocated--;
+        free (p);
+    }
+
+    static uint64  pointer_to_phys (pointer p) { return reinterpret_cast<uint64>(p); }
+    static pointer phys_to_pointer (uint64 p)  { return reinterpret_cast<pointer>(p); }
+};
+
+using Test_pool = Cow_pool<Heap_page_alloc>;
+
+}
+
+TEST_CASE ("Donations limit the number of copies", "[cow_pool]")
+{
+    {
+        Test_pool pool;
+        uint64 phys {0};
+
+        CHECK_FALSE(pool.take (phys));
+
+        pool.add (2);
+        pool.add (1);
+        CHECK(pool.pages() == 3);
+
+        std::set<uint64> taken;
+
+        while (pool.take (phys)) {
+            taken.insert (phys);
+        }
+
+        CHECK(taken.size() == 3);
+        CHECK(pool.pages() == 0);
+
+        // The copies and one index page stay allocated with the pool.
+        CHECK(Heap_page_alloc::allocated == 4);
+    }
+
+    CHECK(Heap_page_alloc::allocated == 0);
+}
+
+TEST_CASE ("Copies are not taken without kernel memory", "[cow_pool]")
+{
+    {
+        Test_pool pool;
+        uint64 phys {0};
+
+        pool.add (2);
+
+        // There is room for the index page, but not for the copy.
+        Heap_page_alloc::limit = 1;
+        CHECK_FALSE(pool.take (phys));
+        CHECK(pool.pages() == 2);
+
+        Heap_page_alloc::limit = 1000;
+        CHECK(pool.take (phys));
+        CHECK(pool.pages() == 1);
+    }
+
+    CHECK(Heap_page_alloc::allocated == 0);
+}
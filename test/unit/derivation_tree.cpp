@@ -0,0 +1,229 @@
+/*
+ * Derivation tree tests
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#include <derivation_tree.hpp>
+
+#include <catch2/catch.hpp>
+
+#include <atomic>
+#include <chrono>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+
+namespace {
+
+struct Node
+{
+    Node *     prev {this};
+    Node *     next {this};
+    Node *     prnt {nullptr};
+    uint16     dpth {0};
+    mword      node_attr;
+    std::mutex tree_lock;
+
+    explicit Node (mword attr = 0) : node_attr (attr) {}
+};
+
+using Tree = Derivation_tree<Node, std::lock_guard<std::mutex>>;
+
+constexpr mword ALL_ATTR {0x7};
+
+// Check the structure of a derivation tree and return the number of its nodes.
+size_t check_tree (Node *root)
+{
+    std::vector<Node *> path {root};
+    size_t nodes {1};
+
+    REQUIRE(root->prnt == nullptr);
+    REQUIRE(root->dpth == 0);
+
+    for (Node *n {root->next}; n != root; n = n->next, nodes++) {
+        REQUIRE(n->prev->next == n);
+        REQUIRE(n->next->prev == n);
+        REQUIRE(n->dpth > 0);
+        REQUIRE(n->dpth <= path.size());
+
+        // The parent is the closest node before this one with a smaller depth.
+        path.resize (n->dpth);
+        REQUIRE(n->prnt == path.back());
+        path.push_back (n);
+    }
+
+    return nodes;
+}
+
+}
+
+TEST_CASE ("Children are linked after their parent", "[derivation_tree]")
+{
+    Node root {ALL_ATTR}, a, b, c;
+
+    CHECK(Tree::insert (&a, &root, ALL_ATTR));
+    CHECK(Tree::insert (&b, &root, 0x3));
+    CHECK(Tree::insert (&c, &a, 0x5));
+
+    CHECK(b.node_attr == 0x3);
+    CHECK(c.node_attr == (a.node_attr & 0x5));
+    CHECK(c.dpth == 2);
+
+    CHECK(root.next == &b);
+    CHECK(b.next == &a);
+    CHECK(a.next == &c);
+    CHECK(c.next == &root);
+
+    CHECK(check_tree (&root) == 4);
+}
+
+TEST_CASE ("Nodes are only removed without attributes and children", "[derivation_tree]")
+{
+    Node root {ALL_ATTR}, a, b, c;
+
+    REQUIRE(Tree::insert (&a, &root, ALL_ATTR));
+    REQUIRE(Tree::insert (&b, &a, ALL_ATTR));
+
+    // Children need attributes.
+    CHECK_FALSE(Tree::insert (&c, &a, 0));
+
+    CHECK_FALSE(Tree::remove (&a));
+
+    Tree::demote (&a, ALL_ATTR);
+    CHECK_FALSE(Tree::remove (&a));
+
+    Tree::demote (&b, ALL_ATTR);
+    CHECK(Tree::remove (&b));
+    CHECK_FALSE(Tree::remove (&b));
+    CHECK(Tree::remove (&a));
+
+    // Removed nodes don't get new children.
+    c.node_attr = ALL_ATTR;
+    CHECK_FALSE(Tree::insert (&c, &b, ALL_ATTR));
+
+    CHECK(check_tree (&root) == 1);
+}
+
+TEST_CASE ("Different trees are changed independently", "[derivation_tree]")
+{
+    Node root_a {ALL_ATTR}, root_b {ALL_ATTR}, a, b;
+
+    REQUIRE(Tree::insert (&a, &root_a, ALL_ATTR));
+
+    std::atomic<bool> done {false};
+    bool inserted {false};
+
+    root_a.tree_lock.lock();
+
+    // Changing the second tree must not wait for the lock of the first one.
+    std::thread other {[&] {
+        inserted = Tree::insert (&b, &root_b, ALL_ATTR);
+        done = true;
+    }};
+
+    auto const deadline {std::chrono::steady_clock::now() + std::chrono::seconds (10)};
+    while (not done and std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::yield();
+    }
+
+    CHECK(done);
+
+    root_a.tree_lock.unlock();
+    other.join();
+
+    CHECK(inserted);
+    CHECK(check_tree (&root_b) == 2);
+}
+
+TEST_CASE ("Concurrent changes keep trees consistent", "[derivation_tree]")
+{
+    constexpr size_t NUM_TREES   {4};
+    constexpr size_t NUM_THREADS {8};
+    constexpr size_t NUM_OPS     {20000};
+
+    // Nodes are never freed, because the trees don't know when unlinked
+    // nodes are unused.
+    std::unique_ptr<Node[]> roots {new Node[NUM_TREES]};
+    std::unique_ptr<Node[]> nodes {new Node[NUM_THREADS * NUM_OPS]};
+    std::unique_ptr<std::atomic<int>[]> removed {new std::atomic<int>[NUM_THREADS * NUM_OPS]};
+
+    // The nodes that were linked at some point, to pick random parents from.
+    std::unique_ptr<std::atomic<Node *>[]> linked {new std::atomic<Node *>[NUM_TREES + NUM_THREADS * NUM_OPS]};
+    std::atomic<size_t> num_linked {NUM_TREES};
+
+    std::atomic<size_t> num_inserts {0}, num_removes {0};
+
+    for (size_t i {0}; i < NUM_TREES; i++) {
+        roots[i].node_attr = ALL_ATTR;
+        linked[i] = &roots[i];
+    }
+
+    for (size_t i {0}; i < NUM_THREADS * NUM_OPS; i++) {
+        removed[i] = 0;
+        linked[NUM_TREES + i] = nullptr;
+    }
+
+    std::vector<std::thread> threads;
+
+    for (size_t t {0}; t < NUM_THREADS; t++) {
+        threads.emplace_back ([&, t] {
+            std::mt19937 rng {static_cast<unsigned>(t)};
+            size_t next_node {t * NUM_OPS};
+
+            for (size_t op {0}; op < NUM_OPS; op++) {
+                Node *const pick {linked[rng() % num_linked]};
+
+                if (not pick) {
+                    continue;
+                }
+
+                if (rng() % 3) {
+                    Node *const n {&nodes[next_node++]};
+
+                    if (Tree::insert (n, pick, ALL_ATTR >> (rng() % 2))) {
+                        linked[num_linked++] = n;
+                        num_inserts++;
+                    }
+                } else if (pick->prnt) {
+                    Tree::demote (pick, ALL_ATTR);
+
+                    if (Tree::remove (pick)) {
+                        removed[pick - nodes.get()]++;
+                        num_removes++;
+                    }
+                }
+            }
+        });
+    }
+
+    for (auto &thread : threads) {
+        thread.join();
+    }
+
+    size_t live {0};
+
+    for (size_t i {0}; i < NUM_TREES; i++) {
+        live += check_tree (&roots[i]);
+    }
+
+    for (size_t i {0}; i < NUM_THREADS * NUM_OPS; i++) {
+        CHECK(removed[i] <= 1);
+    }
+
+    CHECK(num_removes > 0);
+    CHECK(live == NUM_TREES + num_inserts - num_removes);
+}
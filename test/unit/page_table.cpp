@@ -17,6 +17,7 @@
 
 #include <generic_page_table.hpp>
 #include <compiler.hpp>
+#include <mem_protect.hpp>
 
 #include <algorithm>
 #include <cassert>
@@ -24,6 +25,7 @@
 #include <cstdio>
 #include <forward_list>
 #include <initializer_list>
+#include <map>
 
 #include <catch2/catch.hpp>
 
@@ -207,6 +209,10 @@ class Fake_page_alloc
 
         size_t allocated_pages() const { return allocated_pages_; }
 
+        // try_alloc_zeroed_page fails once a page table allocated this many
+        // pages. This is global, so tests that change it have to reset it.
+        static inline size_t page_limit {SIZE_MAX};
+
         freed_memory_list const &get_freed_pages() const
         {
             return freed_;
@@ -228,6 +234,11 @@ class Fake_page_alloc
             return cur;
         }
 
+        pointer try_alloc_zeroed_page()
+        {
+            return allocated_pages_ < page_limit ? alloc_zeroed_page() : pointer {};
+        }
+
         static pointer phys_to_pointer(entry e)   { return {e};    }
         static entry   pointer_to_phys(pointer p) { return p.addr; }
 
@@ -236,6 +247,23 @@ class Fake_page_alloc
             assert ((pointer_to_phys(ptr) & PAGE_MASK) == 0);
             freed_.emplace_back (pointer_to_phys(ptr));
         }
+
+        // Page tables are shared within one Fake_memory, so the reference
+        // counts are global.
+        static inline std::map<uint64_t, unsigned> refs;
+
+        static void ref_page(pointer ptr) { refs[ptr.addr]++; }
+        static bool is_shared_page(pointer ptr) { return refs.count (ptr.addr) and refs[ptr.addr] > 0; }
+
+        static bool unref_page(pointer ptr)
+        {
+            if (not is_shared_page (ptr)) {
+                return true;
+            }
+
+            refs[ptr.addr]--;
+            return false;
+        }
 };
 
 class Fake_deferred_cleanup
@@ -246,6 +274,10 @@ class Fake_deferred_cleanup
         using pointer_vector = std::vector<pointer>;
         pointer_vector lazy_free_pages_;
 
+        // Deferred cache flushes are only accounted, not tracked.
+        size_t pending_cache_bytes_ {0};
+        size_t flushed_cache_bytes_ {0};
+
         Fake_deferred_cleanup(bool tlb_flush, pointer_vector const &lazy_free)
             : tlb_flush_ {tlb_flush},
               lazy_free_pages_ {lazy_free}
@@ -256,6 +288,9 @@ class Fake_deferred_cleanup
 
         pointer_vector get_freed_pages() const { return lazy_free_pages_; }
 
+        size_t pending_cache_bytes() const { return pending_cache_bytes_; }
+        size_t flushed_cache_bytes() const { return flushed_cache_bytes_; }
+
         // The interface expected by Generic_page_table
 
         Fake_deferred_cleanup() = default;
@@ -264,6 +299,7 @@ class Fake_deferred_cleanup
 
         void ignore_tlb_flush() { tlb_flush_ = false; }
         void flush_tlb_later() { tlb_flush_ = true; }
+        void flush_tlb_later(uint64, uint64, unsigned) { tlb_flush_ = true; }
 
         void merge(Fake_deferred_cleanup &other)
         {
@@ -288,6 +324,21 @@ class Fake_deferred_cleanup
             tlb_flush_ = true;
             lazy_free_pages_.emplace_back(page);
         }
+
+        template <typename FLUSH>
+        void flush_cache_later(FLUSH &, pointer, size_t n)
+        {
+            pending_cache_bytes_ += n;
+        }
+
+        template <typename FLUSH>
+        void flush_caches(FLUSH &flush)
+        {
+            flushed_cache_bytes_ += pending_cache_bytes_;
+            pending_cache_bytes_ = 0;
+
+            flush.fence();
+        }
 };
 
 class Fake_attr
@@ -298,23 +349,88 @@ class Fake_attr
             PTE_W = 1ULL << 1,
             PTE_U = 1ULL << 2,
             PTE_S = 1ULL << 7,
+            PTE_L = 1ULL << 9,
+            PTE_COW = 1ULL << 10,
 
             PTE_NX = 1ULL << 63,
         };
 
-        static constexpr uint64_t mask {PTE_NX | PTE_P | PTE_W | PTE_U};
+        static constexpr uint64_t mask {PTE_NX | PTE_P | PTE_W | PTE_U | PTE_COW};
         static constexpr uint64_t all_rights {PTE_P | PTE_W | PTE_U};
 };
 
+// The attributes of EPT-like guest page tables.
+class Fake_ept_attr
+{
+    public:
+        enum : uint64_t {
+            PTE_R = 1ULL << 0,
+            PTE_W = 1ULL << 1,
+            PTE_X = 1ULL << 2,
+            PTE_P = PTE_R | PTE_W | PTE_X,
+            PTE_S = 1ULL << 7,
+            PTE_L = 1ULL << 11,
+            PTE_COW = 1ULL << 52,
+        };
+
+        static constexpr uint64_t mask {PTE_P | PTE_COW};
+        static constexpr uint64_t all_rights {PTE_P};
+};
+
+// The attributes of DPT-like device page tables.
+class Fake_dpt_attr
+{
+    public:
+        enum : uint64_t {
+            PTE_R = 1ULL << 0,
+            PTE_W = 1ULL << 1,
+            PTE_P = PTE_R | PTE_W,
+            PTE_S = 1ULL << 7,
+            PTE_L = 1ULL << 11,
+        };
+
+        static constexpr uint64_t mask {PTE_P};
+        static constexpr uint64_t all_rights {PTE_P};
+};
+
 class Fake_flush
 {
     public:
+        static constexpr bool noncoherent {false};
+
         static void clflush (pointer, size_t) {};
 };
 
+// A cache flush policy for page tables that are used by non-coherent page
+// table walkers, such as some IOMMUs.
+class Fake_noncoherent_flush
+{
+    public:
+        static constexpr bool noncoherent {true};
+
+        // Immediately flushed bytes and the number of fences.
+        static inline size_t flushed_bytes {0};
+        static inline size_t fences {0};
+
+        static void clflush (pointer, size_t n) { flushed_bytes += n; };
+        static void fence() { fences++; }
+};
+
 using Fake_hpt = Generic_page_table<BITS_PER_LEVEL_64BIT, uint64_t, Fake_memory, Fake_flush,
                                     Fake_page_alloc, Fake_deferred_cleanup, Fake_attr>;
 
+using Fake_ept = Generic_page_table<BITS_PER_LEVEL_64BIT, uint64_t, Fake_memory, Fake_flush,
+                                    Fake_page_alloc, Fake_deferred_cleanup, Fake_ept_attr>;
+
+using Fake_dpt = Generic_page_table<BITS_PER_LEVEL_64BIT, uint64_t, Fake_memory, Fake_flush,
+                                    Fake_page_alloc, Fake_deferred_cleanup, Fake_dpt_attr>;
+
+using Fake_noncoherent_hpt = Generic_page_table<BITS_PER_LEVEL_64BIT, uint64_t, Fake_memory, Fake_noncoherent_flush,
+                                                Fake_page_alloc, Fake_deferred_cleanup, Fake_attr>;
+
+using Fake_fixed_hpt = Generic_page_table<BITS_PER_LEVEL_64BIT, uint64_t, Fake_memory, Fake_flush,
+                                          Fake_page_alloc, Fake_deferred_cleanup, Fake_attr, 4>;
+
 Fake_hpt::ord_t const twomb_order {PAGE_BITS +   BITS_PER_LEVEL_64BIT};
 Fake_hpt::ord_t const onegb_order {PAGE_BITS + 2*BITS_PER_LEVEL_64BIT};
 
@@ -654,6 +770,97 @@ TEST_CASE("Updates that changes mappings require TLB shootdowns", "[page_table]"
     }
 }
 
+TEST_CASE("Protect downgrades rights without unmapping", "[page_table]")
+{
+    Fake_memory const mem {{{0x1000, 0x00002000 | Fake_attr::all_rights },
+                            {0x2000, 0x00003000 | Fake_attr::all_rights },
+                            {0x3000, 0x10000000 | Fake_attr::PTE_P | Fake_attr::PTE_W | Fake_attr::PTE_S }}};
+
+    Fake_hpt hpt {4, 3, 0x1000, mem};
+    Fake_deferred_cleanup cleanup;
+
+    auto const remove_write {[] (uint64_t attr) { return attr & ~static_cast<uint64_t>(Fake_attr::PTE_W); }};
+
+    SECTION("Completely covered superpages are kept") {
+        hpt.protect (cleanup, 0, twomb_order, remove_write);
+        CHECK(cleanup.need_tlb_flush());
+
+        auto const mapping {hpt.lookup (PAGE_SIZE)};
+        CHECK(mapping.vaddr == 0);
+        CHECK(mapping.paddr == 0x10000000);
+        CHECK(mapping.attr  == Fake_attr::PTE_P);
+        CHECK(mapping.order == twomb_order);
+    }
+
+    SECTION("Partially covered superpages are split") {
+        hpt.protect (cleanup, PAGE_SIZE, PAGE_BITS, remove_write);
+        CHECK(cleanup.need_tlb_flush());
+
+        for (size_t i {0}; i < 3; i++) {
+            auto const mapping {hpt.lookup (i * PAGE_SIZE)};
+
+            CHECK(mapping.vaddr == i * PAGE_SIZE);
+            CHECK(mapping.paddr == 0x10000000 + i * PAGE_SIZE);
+            CHECK(mapping.attr  == (i == 1 ? Fake_attr::PTE_P : Fake_attr::PTE_P | Fake_attr::PTE_W));
+            CHECK(mapping.order == PAGE_BITS);
+        }
+    }
+
+    SECTION("Unmapped regions are left alone") {
+        hpt.protect (cleanup, 1ULL << onegb_order, onegb_order, remove_write);
+        CHECK_FALSE(cleanup.need_tlb_flush());
+        CHECK_FALSE(hpt.lookup (1ULL << onegb_order).present());
+    }
+
+    SECTION("Mappings that already lack the rights are not touched") {
+        hpt.protect (cleanup, 0, twomb_order, remove_write);
+
+        Fake_deferred_cleanup second;
+        hpt.protect (second, 0, twomb_order, remove_write);
+        CHECK_FALSE(second.need_tlb_flush());
+    }
+}
+
+TEST_CASE("Copy-on-write protection covers all subspaces", "[page_table]")
+{
+    Fake_hpt hpt {4, 3}, npt {4, 3};
+    Fake_ept ept {4, 3};
+    Fake_dpt dpt {4, 3};
+
+    uint64_t const host_rights {Fake_attr::all_rights};
+
+    static_cast<void>(hpt.update ({0, 0x200000, host_rights, twomb_order}));
+    static_cast<void>(npt.update ({0, 0x200000, host_rights, twomb_order}));
+    static_cast<void>(ept.update ({0, 0x200000, Fake_ept_attr::all_rights, twomb_order}));
+    static_cast<void>(dpt.update ({0, 0x200000, Fake_dpt_attr::all_rights, twomb_order}));
+
+    Fake_deferred_cleanup cleanup;
+
+    SECTION("Guest and device page tables lose write access and guests are marked") {
+        protect_subspaces (cleanup, 0, twomb_order, true, false, true, hpt, &npt, &ept, &dpt);
+        CHECK(cleanup.need_tlb_flush());
+
+        CHECK(hpt.lookup (0).attr == ((host_rights & ~static_cast<uint64_t>(Fake_attr::PTE_W)) | Fake_attr::PTE_COW));
+        CHECK(npt.lookup (0).attr == ((host_rights & ~static_cast<uint64_t>(Fake_attr::PTE_W)) | Fake_attr::PTE_COW));
+        CHECK(ept.lookup (0).attr == (Fake_ept_attr::PTE_R | Fake_ept_attr::PTE_X | Fake_ept_attr::PTE_COW));
+        CHECK(dpt.lookup (0).attr == Fake_dpt_attr::PTE_R);
+
+        // Superpages are kept.
+        CHECK(ept.lookup (0).order == twomb_order);
+        CHECK(dpt.lookup (0).order == twomb_order);
+    }
+
+    SECTION("Unused subspaces are skipped") {
+        protect_subspaces<Fake_hpt, Fake_ept, Fake_dpt> (cleanup, 0, PAGE_BITS, true, true, false, hpt, nullptr,
+                                                         nullptr, nullptr);
+
+        CHECK(hpt.lookup (0).attr == (Fake_attr::PTE_P | Fake_attr::PTE_U | Fake_attr::PTE_NX));
+        CHECK(hpt.lookup (PAGE_SIZE).attr == host_rights);
+        CHECK(ept.lookup (0).attr == Fake_ept_attr::all_rights);
+        CHECK(dpt.lookup (0).attr == Fake_dpt_attr::all_rights);
+    }
+}
+
 TEST_CASE("Update that creates superpages reclaims page table structures")
 {
     Fake_memory const mem {{{0x1000, 0x00002000 | Fake_attr::all_rights },
@@ -723,6 +930,353 @@ TEST_CASE("Mapping memory works if it has to create multiple new page tables")
     }
 }
 
+TEST_CASE("Updates take new page tables from a page pool", "[page_table]")
+{
+    // No superpage support
+    Fake_hpt hpt {4, 1};
+    Fake_hpt::Page_pool pool;
+
+    // This 4MB mapping at one gigabyte needs two intermediate and two leaf
+    // page tables.
+    Fake_hpt::Mapping const map {1 << onegb_order, 0, Fake_attr::PTE_P, twomb_order + 1};
+    REQUIRE(hpt.max_new_tables (map) == 4);
+
+    REQUIRE(hpt.reserve (pool, hpt.max_new_tables (map)));
+    CHECK(pool.size() == 4);
+    CHECK(hpt.page_alloc().allocated_pages() == 5);
+
+    Fake_deferred_cleanup cleanup;
+    hpt.update (cleanup, map, &pool);
+
+    CHECK(pool.size() == 0);
+    CHECK(hpt.page_alloc().allocated_pages() == 5);
+
+    for (size_t offset {0}; offset < map.size(); offset += PAGE_SIZE) {
+        REQUIRE(hpt.lookup (map.vaddr + offset).paddr == offset);
+    }
+
+    SECTION("Unused pages are returned to the page allocator") {
+        REQUIRE(hpt.reserve (pool, 2));
+        hpt.update (cleanup, map, &pool);
+
+        CHECK(pool.size() == 2);
+
+        hpt.release (pool);
+
+        CHECK(pool.size() == 0);
+        CHECK(hpt.page_alloc().get_freed_pages().size() == 2);
+    }
+
+    SECTION("Reservations fail when the page allocator runs out of memory") {
+        struct Reset_limit { ~Reset_limit() { Fake_page_alloc::page_limit = SIZE_MAX; } } const reset_limit;
+
+        Fake_hpt::Mapping const other {2ULL << onegb_order, 0, Fake_attr::PTE_P, PAGE_BITS};
+        REQUIRE(hpt.max_new_tables (other) == 2);
+
+        Fake_page_alloc::page_limit = hpt.page_alloc().allocated_pages() + 1;
+
+        CHECK_FALSE(hpt.reserve (pool, hpt.max_new_tables (other)));
+        CHECK(pool.size() == 1);
+        CHECK_FALSE(hpt.lookup (other.vaddr).present());
+
+        hpt.release (pool);
+    }
+}
+
+TEST_CASE("Fixed-depth page tables behave like run-time depth ones", "[page_table]")
+{
+    Fake_hpt       hpt   {4, 3};
+    Fake_fixed_hpt fixed {4, 3};
+
+    CHECK(fixed.max_levels() == 4);
+    CHECK(fixed.max_order() == hpt.max_order());
+
+    std::vector<Fake_hpt::Mapping> const updates {
+        {0,                         0x40000000, Fake_attr::PTE_P | Fake_attr::PTE_W, onegb_order},
+        {1ULL << onegb_order,       0x80000000, Fake_attr::PTE_P,                    twomb_order},
+        {PAGE_SIZE,                 0x1000,     Fake_attr::PTE_P,                    PAGE_BITS},
+        {(1ULL << onegb_order) + 2 * PAGE_SIZE, 0, 0,                               PAGE_BITS},
+    };
+
+    for (auto const &m : updates) {
+        static_cast<void>(hpt.update (m));
+        static_cast<void>(fixed.update ({m.vaddr, m.paddr, m.attr, m.order}));
+    }
+
+    std::vector<uint64_t> const lookups {0, PAGE_SIZE, 2 * PAGE_SIZE, 1ULL << twomb_order, 1ULL << onegb_order,
+                                         (1ULL << onegb_order) + 2 * PAGE_SIZE,
+                                         (1ULL << onegb_order) + 3 * PAGE_SIZE, 2ULL << onegb_order};
+
+    for (uint64_t vaddr : lookups) {
+        auto const expected {hpt.lookup (vaddr)};
+        auto const actual   {fixed.lookup (vaddr)};
+
+        CHECK(actual.vaddr == expected.vaddr);
+        CHECK(actual.paddr == expected.paddr);
+        CHECK(actual.attr  == expected.attr);
+        CHECK(actual.order == expected.order);
+    }
+
+    CHECK(fixed.table_pages() == hpt.table_pages());
+}
+
+TEST_CASE("Page tables in use are counted", "[page_table]")
+{
+    Fake_hpt hpt {4, 3};
+    CHECK(hpt.table_pages() == 1);
+
+    // A single 4K page needs one page table on each level below the root.
+    static_cast<void>(hpt.update ({0, 0, Fake_attr::PTE_P, PAGE_BITS}));
+    CHECK(hpt.table_pages() == 4);
+
+    // A superpage replaces the lowest page table.
+    static_cast<void>(hpt.update ({0, 0, Fake_attr::PTE_P, twomb_order}));
+    CHECK(hpt.table_pages() == 3);
+
+    // Splitting the superpage again brings it back.
+    Fake_deferred_cleanup cleanup;
+    hpt.protect (cleanup, 0, PAGE_BITS, [] (uint64_t attr) { return attr | Fake_attr::PTE_NX; });
+    CHECK(hpt.table_pages() == 4);
+
+    // Unmapping a whole 1GB region frees everything but the two upper levels.
+    static_cast<void>(hpt.update ({0, 0, 0, onegb_order}));
+    CHECK(hpt.table_pages() == 2);
+}
+
+TEST_CASE("Worst-case page table reservation", "[page_table]")
+{
+    Fake_hpt hpt {4, 2};
+
+    // Superpages need no page tables below them.
+    CHECK(hpt.max_new_tables ({0, 0, Fake_attr::PTE_P, twomb_order}) == 2);
+    CHECK(hpt.max_new_tables ({0, 0, Fake_attr::PTE_P, PAGE_BITS}) == 3);
+
+    // Without 1GB pages, each 1GB region needs a page directory and all
+    // its entries can be 2MB pages.
+    CHECK(hpt.max_new_tables ({0, 0, Fake_attr::PTE_P, onegb_order}) == 1 + 1);
+    CHECK(hpt.max_new_tables ({0, 0, Fake_attr::PTE_P, onegb_order + 1}) == 1 + 2);
+
+    // Unmapping an empty region needs nothing.
+    CHECK(hpt.max_new_tables ({0, 0, 0, onegb_order + 1}) == 0);
+}
+
+TEST_CASE("Page table reservation counts only missing page tables", "[page_table]")
+{
+    // Reference counts are global, so they must not leak into other tests.
+    struct Clear_refs { ~Clear_refs() { Fake_page_alloc::refs.clear(); } } const clear_refs;
+
+    uint64_t const attr {Fake_attr::PTE_P | Fake_attr::PTE_U};
+
+    SECTION("Existing page tables are reused") {
+        // No superpage support
+        Fake_hpt hpt {4, 1};
+
+        // A 1GB region needs a page directory and 512 page tables.
+        CHECK(hpt.max_new_tables ({0, 0, attr, onegb_order}) == 1 + 1 + 512);
+
+        Fake_hpt::Mapping const map {0, 0, attr, twomb_order + 1};
+        static_cast<void>(hpt.update (map));
+
+        CHECK(hpt.max_new_tables (map) == 0);
+        CHECK(hpt.max_new_tables ({PAGE_SIZE, 0, 0, PAGE_BITS}) == 0);
+        CHECK(hpt.max_new_tables ({0, 0, attr, twomb_order + 2}) == 2);
+        CHECK(hpt.max_new_tables ({0, 0, attr, onegb_order}) == 510);
+    }
+
+    SECTION("Superpages are split") {
+        Fake_hpt hpt {4, 2};
+
+        static_cast<void>(hpt.update ({0, 0, attr, twomb_order}));
+
+        CHECK(hpt.max_new_tables ({0, 0, attr, twomb_order}) == 0);
+        CHECK(hpt.max_new_tables ({PAGE_SIZE, 0, 0, PAGE_BITS}) == 1);
+        CHECK(hpt.max_new_tables ({PAGE_SIZE, 0, attr, PAGE_BITS}) == 1);
+    }
+
+    SECTION("Shared page tables are copied") {
+        Fake_hpt hpt {4, 3};
+        Fake_deferred_cleanup cleanup;
+        Fake_hpt::Page_pool pool;
+
+        uint64_t const shared_vaddr {1ULL << onegb_order};
+
+        static_cast<void>(hpt.update ({0, 0x40000000, attr, PAGE_BITS}));
+        REQUIRE(hpt.share_from (cleanup, hpt, 0, shared_vaddr, twomb_order, [] (uint64_t) { return true; }));
+
+        Fake_hpt::Mapping const map {shared_vaddr + PAGE_SIZE, 0, attr, PAGE_BITS};
+        REQUIRE(hpt.max_new_tables (map) == 1);
+
+        REQUIRE(hpt.reserve (pool, hpt.max_new_tables (map)));
+        auto const allocated {hpt.page_alloc().allocated_pages()};
+
+        hpt.update (cleanup, map, &pool);
+
+        CHECK(pool.size() == 0);
+        CHECK(hpt.page_alloc().allocated_pages() == allocated);
+        CHECK(hpt.max_new_tables (map) == 0);
+    }
+}
+
+TEST_CASE("Non-coherent page table updates coalesce cache flushes", "[page_table]")
+{
+    // No superpage support
+    Fake_noncoherent_hpt hpt {4, 1};
+
+    Fake_noncoherent_flush::flushed_bytes = 0;
+    Fake_noncoherent_flush::fences = 0;
+
+    // This 4MB mapping creates two intermediate and two leaf page tables.
+    uint64_t const virt {1 << onegb_order};
+    auto const cleanup {hpt.update ({virt, 0, Fake_attr::PTE_P, twomb_order + 1})};
+
+    // New page tables are flushed before they are linked into the page table.
+    CHECK(Fake_noncoherent_flush::flushed_bytes == 4 * PAGE_SIZE);
+
+    // Modified entries are written back with a single fence at the end: one
+    // entry in each of the PML4 and PDPT, two in the PD and all leaf entries.
+    CHECK(Fake_noncoherent_flush::fences == 1);
+    CHECK(cleanup.pending_cache_bytes() == 0);
+    CHECK(cleanup.flushed_cache_bytes() == (1 + 1 + 2 + 2 * 512) * sizeof(entry));
+}
+
+TEST_CASE("Linked page tables are shared, but not owned", "[page_table]")
+{
+    // A 4K mapping at 1GB. The page table at 0x8000 is empty.
+    Fake_memory const mem {{{0x1000, 0x00002000 | Fake_attr::all_rights },
+                            {0x2008, 0x00003000 | Fake_attr::all_rights },
+                            {0x3000, 0x00004000 | Fake_attr::all_rights },
+                            {0x4000, 0xCAFE0000 | Fake_attr::PTE_P }}};
+
+    Fake_hpt src {4, 3, 0x1000, mem};
+    Fake_hpt dst {4, 3, 0x8000, mem};
+
+    uint64_t const vaddr {1UL << onegb_order};
+    Fake_deferred_cleanup cleanup;
+
+    dst.link_from (cleanup, src, vaddr, onegb_order);
+
+    CHECK_FALSE(cleanup.need_tlb_flush());
+    CHECK(dst.lookup (vaddr) == src.lookup (vaddr));
+    CHECK(dst.page_alloc().allocated_pages() == 1);
+
+    SECTION("Removing the link does not free linked page tables") {
+        auto const unmap_cleanup {dst.update ({0, 0, 0, PAGE_BITS + 3*BITS_PER_LEVEL_64BIT})};
+        CHECK(unmap_cleanup.need_tlb_flush());
+
+        // Only the PDPT that dst allocated itself is freed.
+        auto const lazily_freed {unmap_cleanup.get_freed_pages()};
+
+        REQUIRE(lazily_freed.size() == 1);
+        CHECK(lazily_freed[0] == 0x10000000);
+    }
+}
+
+TEST_CASE("Shared page tables are copied before they are modified", "[page_table]")
+{
+    // Reference counts are global, so they must not leak into other tests.
+    struct Clear_refs { ~Clear_refs() { Fake_page_alloc::refs.clear(); } } const clear_refs;
+
+    Fake_hpt hpt {4, 3};
+    Fake_deferred_cleanup cleanup;
+
+    uint64_t const shared_vaddr {1ULL << onegb_order};
+    uint64_t const attr {Fake_attr::PTE_P | Fake_attr::PTE_U};
+    auto const accept_all {[] (uint64_t) { return true; }};
+
+    static_cast<void>(hpt.update ({0,         0x40000000, attr, PAGE_BITS}));
+    static_cast<void>(hpt.update ({PAGE_SIZE, 0x40001000, attr, PAGE_BITS}));
+
+    auto const tables {hpt.table_pages()};
+
+    REQUIRE(hpt.share_from (cleanup, hpt, 0, shared_vaddr, twomb_order, accept_all));
+
+    // The page directory for the new region is new and the shared page
+    // table counts for both regions.
+    CHECK(hpt.table_pages() == tables + 2);
+    CHECK(hpt.lookup (shared_vaddr + PAGE_SIZE).paddr == 0x40001000);
+
+    SECTION("Modifications only affect the modified page table") {
+        static_cast<void>(hpt.update ({shared_vaddr, 0, 0, PAGE_BITS}));
+
+        CHECK_FALSE(hpt.lookup (shared_vaddr).present());
+        CHECK(hpt.lookup (shared_vaddr + PAGE_SIZE).paddr == 0x40001000);
+        CHECK(hpt.lookup (0).paddr == 0x40000000);
+        CHECK(hpt.table_pages() == tables + 2);
+    }
+
+    SECTION("Shared page tables are freed with the last reference") {
+        auto const unmap_first {hpt.update ({0, 0, 0, twomb_order})};
+        CHECK(unmap_first.get_freed_pages().empty());
+        CHECK(hpt.lookup (shared_vaddr + PAGE_SIZE).paddr == 0x40001000);
+        CHECK(hpt.table_pages() == tables + 1);
+
+        auto const unmap_last {hpt.update ({shared_vaddr, 0, 0, twomb_order})};
+        CHECK(unmap_last.get_freed_pages().size() == 1);
+        CHECK(hpt.table_pages() == tables);
+    }
+
+    SECTION("Sharing can be refused") {
+        Fake_deferred_cleanup refused;
+
+        CHECK_FALSE(hpt.share_from (refused, hpt, 0, 2 * shared_vaddr, twomb_order, [] (uint64_t) { return false; }));
+        CHECK_FALSE(hpt.share_from (refused, hpt, 4 * shared_vaddr, 2 * shared_vaddr, twomb_order, accept_all));
+        CHECK_FALSE(hpt.lookup (2 * shared_vaddr).present());
+    }
+}
+
+TEST_CASE("Shared page tables are counted by every page table that uses them", "[page_table]")
+{
+    // Reference counts are global, so they must not leak into other tests.
+    struct Clear_refs { ~Clear_refs() { Fake_page_alloc::refs.clear(); } } const clear_refs;
+
+    // A 4K mapping at 0. The page table at 0x8000 is empty.
+    Fake_memory const mem {{{0x1000, 0x00002000 | Fake_attr::all_rights },
+                            {0x2000, 0x00003000 | Fake_attr::all_rights },
+                            {0x3000, 0x00004000 | Fake_attr::all_rights },
+                            {0x4000, 0xCAFE0000 | Fake_attr::PTE_P | Fake_attr::PTE_U }}};
+
+    Fake_hpt src {4, 3, 0x1000, mem};
+    Fake_hpt dst {4, 3, 0x8000, mem};
+
+    uint64_t const vaddr {1ULL << onegb_order};
+    Fake_deferred_cleanup cleanup;
+
+    REQUIRE(dst.share_from (cleanup, src, 0, vaddr, twomb_order, [] (uint64_t) { return true; }));
+
+    // A page directory pointer table, a page directory and the shared page
+    // table.
+    CHECK(src.table_pages() == 0);
+    CHECK(dst.table_pages() == 3);
+
+    SECTION("The sharer outlives the original page table") {
+        auto const unmap_src {src.update ({0, 0, 0, twomb_order})};
+
+        CHECK(unmap_src.get_freed_pages().empty());
+        CHECK(src.table_pages() == -1);
+        CHECK(dst.table_pages() == 3);
+        CHECK(dst.lookup (vaddr).paddr == 0xCAFE0000);
+
+        auto const unmap_dst {dst.update ({vaddr, 0, 0, twomb_order})};
+
+        REQUIRE(unmap_dst.get_freed_pages().size() == 1);
+        CHECK(unmap_dst.get_freed_pages()[0] == 0x4000);
+        CHECK(dst.table_pages() == 2);
+    }
+
+    SECTION("Copies replace the shared page table") {
+        static_cast<void>(dst.update ({vaddr + PAGE_SIZE, 0, Fake_attr::PTE_P, PAGE_BITS}));
+
+        CHECK(dst.table_pages() == 3);
+
+        auto const unmap_src {src.update ({0, 0, 0, twomb_order})};
+
+        REQUIRE(unmap_src.get_freed_pages().size() == 1);
+        CHECK(unmap_src.get_freed_pages()[0] == 0x4000);
+        CHECK(src.table_pages() == -1);
+        CHECK(dst.table_pages() == 3);
+    }
+}
+
 TEST_CASE("Replacing read-only pages works", "[page_table]")
 {
     Fake_memory const mem {{{0x1000, 0x00002000 | Fake_attr::all_rights },
@@ -0,0 +1,133 @@
+/*
+ * PCID assignment tests
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#include <pcid.hpp>
+
+#include <catch2/catch.hpp>
+
+#include <set>
+
+using Test_pcid = Pcid<int>;
+
+// The memory spaces in these tests are identified by their generation.
+static int spaces[Test_pcid::NUM_SLOTS + 2];
+
+static unsigned assign (Test_pcid &pcids, uint64 generation, bool &fresh)
+{
+    int *evicted {nullptr};
+    unsigned const pcid {pcids.assign (&spaces[generation], generation, fresh, evicted)};
+
+    // Only fresh PCIDs can have a former owner.
+    CHECK((fresh or evicted == nullptr));
+    return pcid;
+}
+
+TEST_CASE ("Recently used memory spaces keep their PCID", "[pcid]")
+{
+    Test_pcid pcids;
+    bool fresh {false};
+
+    unsigned const first {assign (pcids, 1, fresh)};
+    CHECK(fresh);
+    CHECK(first != 0);
+
+    unsigned const second {assign (pcids, 2, fresh)};
+    CHECK(fresh);
+    CHECK(second != first);
+
+    CHECK(assign (pcids, 1, fresh) == first);
+    CHECK_FALSE(fresh);
+    CHECK(assign (pcids, 2, fresh) == second);
+    CHECK_FALSE(fresh);
+}
+
+TEST_CASE ("The least recently used PCID is reassigned", "[pcid]")
+{
+    Test_pcid pcids;
+    bool fresh {false};
+    std::set<unsigned> used;
+
+    for (uint64 gen {1}; gen <= Test_pcid::NUM_SLOTS; gen++) {
+        unsigned const pcid {assign (pcids, gen, fresh)};
+
+        CHECK(fresh);
+        CHECK(pcid > 0);
+        CHECK(pcid <= Test_pcid::NUM_SLOTS);
+        used.insert (pcid);
+    }
+
+    CHECK(used.size() == Test_pcid::NUM_SLOTS);
+
+    // Use all memory spaces again, but the first one last. Afterwards, the
+    // second one is the least recently used.
+    unsigned const first {assign (pcids, 1, fresh)};
+    unsigned const second {assign (pcids, 2, fresh)};
+
+    for (uint64 gen {3}; gen <= Test_pcid::NUM_SLOTS; gen++) {
+        assign (pcids, gen, fresh);
+    }
+
+    assign (pcids, 1, fresh);
+
+    // A new memory space takes the PCID of the second one, which has to be
+    // flushed before use.
+    int *evicted {nullptr};
+
+    CHECK(pcids.assign (&spaces[Test_pcid::NUM_SLOTS + 1], Test_pcid::NUM_SLOTS + 1, fresh, evicted) == second);
+    CHECK(fresh);
+    CHECK(evicted == &spaces[2]);
+
+    CHECK(assign (pcids, 1, fresh) == first);
+    CHECK_FALSE(fresh);
+
+    assign (pcids, 2, fresh);
+    CHECK(fresh);
+}
+
+TEST_CASE ("Released PCIDs give up their owners", "[pcid]")
+{
+    Test_pcid pcids;
+    bool fresh {false};
+
+    auto const any {[] (int *) { return true; }};
+
+    CHECK(pcids.release (any) == nullptr);
+
+    unsigned const first {assign (pcids, 1, fresh)};
+    unsigned const second {assign (pcids, 2, fresh)};
+    assign (pcids, 3, fresh);
+
+    // Only owners that match are released.
+    CHECK(pcids.release ([] (int *owner) { return owner == &spaces[3]; }) == &spaces[3]);
+    CHECK(pcids.release ([] (int *owner) { return owner == &spaces[3]; }) == nullptr);
+
+    // The other memory spaces keep their PCIDs.
+    CHECK(assign (pcids, 2, fresh) == second);
+    CHECK_FALSE(fresh);
+
+    std::set<int *> released;
+
+    for (int *owner; (owner = pcids.release (any));) {
+        released.insert (owner);
+    }
+
+    CHECK(released == std::set<int *> {&spaces[1], &spaces[2]});
+
+    // Memory spaces need a flush after their PCID was released.
+    CHECK(assign (pcids, 1, fresh) == first);
+    CHECK(fresh);
+}
@@ -0,0 +1,276 @@
+/*
+ * Radix tree tests
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#include <radix_tree.hpp>
+
+#include <catch2/catch.hpp>
+
+#include <cstdlib>
+#include <map>
+#include <memory>
+#include <random>
+#include <vector>
+
+namespace {
+
+struct Entry
+{
+    mword node_base;
+    mword node_order;
+};
+
+struct Counting_alloc
+{
+    static inline int allocated {0};
+
+    // Nodes that concurrent lookups may still see. They are freed with the
+    // tree, which ends all lookups.
+    std::vector<void *> deferred;
+
+    Counting_alloc() = default;
+
+    Counting_alloc (Counting_alloc const &) = delete;
+    Counting_alloc &operator= (Counting_alloc const &) = delete;
+
+    ~Counting_alloc()
+    {
+        for (void *node : deferred) {
+            free (node);
+        }
+    }
+
+    void *alloc()
+    {
+        allocated++;
+        return calloc (1, sizeof (Radix_tree<Entry, Counting_alloc>::Node));
+    }
+
+    void free (void *node)
+    {
+        allocated--;
+        ::free (node);
+    }
+
+    void free_deferred (void *node)
+    {
+        deferred.push_back (node);
+    }
+};
+
+using Tree = Radix_tree<Entry, Counting_alloc>;
+
+}
+
+TEST_CASE ("Entries are found for all their keys", "[radix_tree]")
+{
+    Tree tree;
+    Entry small {0x1234, 0}, medium {0x40, 3}, large {0x10000, 16};
+
+    CHECK(tree.lookup (0) == nullptr);
+
+    REQUIRE(tree.insert (&small));
+    REQUIRE(tree.insert (&medium));
+    REQUIRE(tree.insert (&large));
+
+    CHECK(tree.lookup (0x1234) == &small);
+    CHECK(tree.lookup (0x1235) == nullptr);
+
+    for (mword key {0x40}; key < 0x48; key++) {
+        CHECK(tree.lookup (key) == &medium);
+    }
+
+    CHECK(tree.lookup (0x48) == nullptr);
+
+    CHECK(tree.lookup (0x10000) == &large);
+    CHECK(tree.lookup (0x1ffff) == &large);
+    CHECK(tree.lookup (0x20000) == nullptr);
+    CHECK(tree.lookup (~static_cast<mword>(0)) == nullptr);
+}
+
+TEST_CASE ("Lookups can return the next entry", "[radix_tree]")
+{
+    Tree tree;
+    Entry a {0x8, 3}, b {0x1000, 0}, c {0x3000000, 20};
+
+    REQUIRE(tree.insert (&a));
+    REQUIRE(tree.insert (&b));
+    REQUIRE(tree.insert (&c));
+
+    CHECK(tree.lookup (0, true) == &a);
+    CHECK(tree.lookup (0xf, true) == &a);
+    CHECK(tree.lookup (0x10, true) == &b);
+    CHECK(tree.lookup (0x1000, true) == &b);
+    CHECK(tree.lookup (0x1001, true) == &c);
+    CHECK(tree.lookup (0x3000000 + 0x12345, true) == &c);
+    CHECK(tree.lookup (0x3100000, true) == nullptr);
+}
+
+TEST_CASE ("Cursors visit entries in order", "[radix_tree]")
+{
+    Tree tree;
+    Entry a {0x8, 3}, b {0x40, 6}, c {0x1000, 0}, d {0x3000000, 20}, last {~static_cast<mword>(0), 0};
+
+    for (Entry *e : {&d, &b, &last, &a, &c}) {
+        REQUIRE(tree.insert (e));
+    }
+
+    Tree::Cursor cursor {0x9};
+
+    CHECK(tree.seek (cursor) == &a);
+    CHECK(tree.next (cursor) == &b);
+    CHECK(tree.next (cursor) == &c);
+    CHECK(tree.next (cursor) == &d);
+    CHECK(tree.next (cursor) == &last);
+    CHECK(tree.next (cursor) == nullptr);
+    CHECK(cursor.end());
+
+    Tree::Cursor behind {0x1001};
+
+    CHECK(tree.seek (behind) == &d);
+    CHECK(behind.key() == 0x3100000);
+}
+
+TEST_CASE ("Overlapping entries are rejected", "[radix_tree]")
+{
+    Tree tree;
+    Entry large {0x1000, 12}, inside {0x1800, 0}, covering {0, 16}, same {0x1000, 12}, beside {0x2000, 12};
+
+    REQUIRE(tree.insert (&large));
+
+    CHECK_FALSE(tree.insert (&inside));
+    CHECK_FALSE(tree.insert (&covering));
+    CHECK_FALSE(tree.insert (&same));
+    CHECK(tree.insert (&beside));
+
+    CHECK_FALSE(tree.remove (&inside));
+    CHECK_FALSE(tree.remove (&same));
+    CHECK(tree.lookup (0x1000) == &large);
+}
+
+TEST_CASE ("Empty nodes are freed deferred", "[radix_tree]")
+{
+    {
+        Tree tree;
+        Entry a {0x12345, 0}, b {0x23456, 0};
+
+        REQUIRE(tree.insert (&a));
+        int const nodes {Counting_alloc::allocated};
+
+        REQUIRE(tree.remove (&a));
+        CHECK(tree.lookup (0x12345) == nullptr);
+        CHECK(tree.lookup (0, true) == nullptr);
+
+        // The unlinked nodes stay valid, but are not reused.
+        REQUIRE(tree.insert (&b));
+        CHECK(Counting_alloc::allocated == 2 * nodes);
+        CHECK(tree.lookup (0x23456) == &b);
+    }
+
+    CHECK(Counting_alloc::allocated == 0);
+}
+
+TEST_CASE ("Random changes match a reference map", "[radix_tree]")
+{
+    constexpr size_t NUM_ENTRIES {2000};
+
+    std::mt19937 rng {0};
+    Tree tree;
+
+    // The reference maps the base of each entry in the tree to the entry.
+    std::map<mword, Entry *> reference;
+    std::vector<std::unique_ptr<Entry>> entries;
+
+    auto const overlaps {[&reference] (mword base, mword order) {
+        mword const end {base + (static_cast<mword>(1) << order)};
+        auto it {reference.lower_bound (base)};
+
+        if (it != reference.end() and it->first < end) {
+            return true;
+        }
+
+        if (it == reference.begin()) {
+            return false;
+        }
+
+        --it;
+        return it->first + (static_cast<mword>(1) << it->second->node_order) > base;
+    }};
+
+    for (size_t i {0}; i < NUM_ENTRIES; i++) {
+        mword const order {rng() % 3 ? rng() % 4 : rng() % 14};
+        mword const base  {(static_cast<mword>(rng()) % (1U << 20)) & ~((static_cast<mword>(1) << order) - 1)};
+
+        entries.emplace_back (new Entry {base, order});
+        Entry *const e {entries.back().get()};
+
+        bool const expected {not overlaps (base, order)};
+
+        CHECK(tree.insert (e) == expected);
+
+        if (expected) {
+            reference[base] = e;
+        }
+
+        // Remove some entries again.
+        if (rng() % 4 == 0 and not reference.empty()) {
+            auto it {reference.begin()};
+            std::advance (it, rng() % reference.size());
+
+            CHECK(tree.remove (it->second));
+            reference.erase (it);
+        }
+    }
+
+    for (int probe {0}; probe < 10000; probe++) {
+        mword const key {static_cast<mword>(rng()) % (1U << 21)};
+
+        // The reference entry that covers key or follows it.
+        Entry *covering {nullptr}, *next {nullptr};
+        auto it {reference.upper_bound (key)};
+
+        if (it != reference.end()) {
+            next = it->second;
+        }
+
+        if (it != reference.begin()) {
+            --it;
+
+            if (it->first + (static_cast<mword>(1) << it->second->node_order) > key) {
+                covering = it->second;
+            }
+        }
+
+        CHECK(tree.lookup (key) == covering);
+        CHECK(tree.lookup (key, true) == (covering ? covering : next));
+    }
+
+    // A cursor visits the same entries as the reference.
+    Tree::Cursor cursor {0};
+    std::vector<Entry *> visited;
+
+    for (Entry *e {tree.seek (cursor)}; e; e = tree.next (cursor)) {
+        visited.push_back (e);
+    }
+
+    std::vector<Entry *> expected;
+
+    for (auto const &r : reference) {
+        expected.push_back (r.second);
+    }
+
+    CHECK(visited == expected);
+}
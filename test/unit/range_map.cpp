@@ -0,0 +1,97 @@
+/*
+ * Range map tests
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#include <range_map.hpp>
+
+#include <catch2/catch.hpp>
+
+using Test_map = Range_map<int, 8>;
+
+TEST_CASE ("Empty range map covers everything", "[range_map]")
+{
+    Test_map m {0x10000};
+
+    CHECK(m.size() == 1);
+    CHECK(m.lookup (0)      == Test_map::Range {0, 0x10000, 0});
+    CHECK(m.lookup (0xffff) == Test_map::Range {0, 0x10000, 0});
+}
+
+TEST_CASE ("Setting ranges splits and merges", "[range_map]")
+{
+    Test_map m {0x10000};
+
+    REQUIRE(m.set (0x1000, 0x3000, 1));
+    CHECK(m.size() == 3);
+    CHECK(m.lookup (0x0fff) == Test_map::Range {0,      0x1000,  0});
+    CHECK(m.lookup (0x1000) == Test_map::Range {0x1000, 0x3000,  1});
+    CHECK(m.lookup (0x3000) == Test_map::Range {0x3000, 0x10000, 0});
+
+    SECTION ("Overwriting the middle of a range") {
+        REQUIRE(m.set (0x1800, 0x2000, 2));
+        CHECK(m.size() == 5);
+        CHECK(m.lookup (0x1000) == Test_map::Range {0x1000, 0x1800, 1});
+        CHECK(m.lookup (0x1800) == Test_map::Range {0x1800, 0x2000, 2});
+        CHECK(m.lookup (0x2000) == Test_map::Range {0x2000, 0x3000, 1});
+    }
+
+    SECTION ("Adjacent ranges with the same value are merged") {
+        REQUIRE(m.set (0x3000, 0x4000, 1));
+        REQUIRE(m.set (0x0800, 0x1000, 1));
+        CHECK(m.size() == 3);
+        CHECK(m.lookup (0x2000) == Test_map::Range {0x0800, 0x4000, 1});
+    }
+
+    SECTION ("Ranges spanning multiple boundaries are replaced") {
+        REQUIRE(m.set (0x1800, 0x2000, 2));
+        REQUIRE(m.set (0, 0x2800, 3));
+        CHECK(m.size() == 3);
+        CHECK(m.lookup (0)      == Test_map::Range {0,      0x2800,  3});
+        CHECK(m.lookup (0x2800) == Test_map::Range {0x2800, 0x3000,  1});
+    }
+
+    SECTION ("Setting everything to one value leaves one range") {
+        REQUIRE(m.set (0, 0x10000, 0));
+        CHECK(m.size() == 1);
+        CHECK(m.lookup (0x2000) == Test_map::Range {0, 0x10000, 0});
+    }
+
+    SECTION ("Ranges can extend to the limit") {
+        REQUIRE(m.set (0x8000, 0x10000, 1));
+        CHECK(m.size() == 4);
+        CHECK(m.lookup (0xffff) == Test_map::Range {0x8000, 0x10000, 1});
+    }
+}
+
+TEST_CASE ("Range map fails gracefully when full", "[range_map]")
+{
+    Test_map m {0x10000};
+
+    // Each of these creates two new boundaries.
+    REQUIRE(m.set (0x1000, 0x2000, 1));
+    REQUIRE(m.set (0x3000, 0x4000, 1));
+    REQUIRE(m.set (0x5000, 0x6000, 1));
+
+    CHECK(m.size() == 7);
+    CHECK_FALSE(m.set (0x7000, 0x8000, 1));
+
+    // Nothing changed.
+    CHECK(m.size() == 7);
+    CHECK(m.lookup (0x7000) == Test_map::Range {0x6000, 0x10000, 0});
+
+    // Extending an existing range needs no space.
+    CHECK(m.set (0x6000, 0x7000, 1));
+}
@@ -0,0 +1,150 @@
+/*
+ * Temporary mapping slot tests
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#include <remap_slots.hpp>
+
+#include <catch2/catch.hpp>
+
+#include <map>
+#include <set>
+
+static constexpr uint64 WINDOW {0x200000};
+
+TEST_CASE ("Mappings are reused while they are present", "[remap_slots]")
+{
+    Remap_slots slots;
+    bool fresh {false};
+
+    unsigned const first {slots.acquire (1 * WINDOW, fresh)};
+    CHECK(fresh);
+    slots.release (first);
+
+    unsigned const second {slots.acquire (2 * WINDOW, fresh)};
+    CHECK(fresh);
+    CHECK(second != first);
+    slots.release (second);
+
+    CHECK(slots.acquire (1 * WINDOW, fresh) == first);
+    CHECK_FALSE(fresh);
+    slots.release (first);
+}
+
+TEST_CASE ("The same memory can be pinned more than once", "[remap_slots]")
+{
+    Remap_slots slots;
+    bool fresh {false};
+
+    unsigned const outer {slots.acquire (WINDOW, fresh)};
+    CHECK(fresh);
+
+    CHECK(slots.acquire (WINDOW, fresh) == outer);
+    CHECK_FALSE(fresh);
+
+    slots.release (outer);
+    slots.release (outer);
+}
+
+TEST_CASE ("The least recently used slot is reused", "[remap_slots]")
+{
+    Remap_slots slots;
+    bool fresh {false};
+    unsigned slot[Remap_slots::NUM_SLOTS];
+
+    for (uint64 i {0}; i < Remap_slots::NUM_SLOTS; i++) {
+        slot[i] = slots.acquire (i * WINDOW, fresh);
+        CHECK(fresh);
+        slots.release (slot[i]);
+    }
+
+    CHECK(std::set<unsigned> (slot, slot + Remap_slots::NUM_SLOTS).size() == Remap_slots::NUM_SLOTS);
+
+    // Touch the first mapping, so the second one is the oldest.
+    CHECK(slots.acquire (0, fresh) == slot[0]);
+    CHECK_FALSE(fresh);
+    slots.release (slot[0]);
+
+    unsigned const replaced {slots.acquire (Remap_slots::NUM_SLOTS * WINDOW, fresh)};
+    CHECK(fresh);
+    CHECK(replaced == slot[1]);
+    slots.release (replaced);
+}
+
+TEST_CASE ("Pinned slots are not reused", "[remap_slots]")
+{
+    Remap_slots slots;
+    bool fresh {false};
+    std::set<unsigned> pinned;
+
+    for (uint64 i {0}; i < Remap_slots::NUM_SLOTS - 1; i++) {
+        pinned.insert (slots.acquire (i * WINDOW, fresh));
+    }
+
+    unsigned const last {slots.acquire (Remap_slots::NUM_SLOTS * WINDOW, fresh)};
+    CHECK(fresh);
+    CHECK(pinned.count (last) == 0);
+
+    // All slots are pinned now.
+    CHECK(slots.unpinned() == 0);
+    CHECK(slots.acquire ((Remap_slots::NUM_SLOTS + 1) * WINDOW, fresh) == Remap_slots::NUM_SLOTS);
+
+    slots.release (last);
+    CHECK(slots.unpinned() == 1);
+
+    CHECK(slots.acquire ((Remap_slots::NUM_SLOTS + 1) * WINDOW, fresh) == last);
+    CHECK(fresh);
+}
+
+TEST_CASE ("Windows stay valid across the handover to CPU-local slots", "[remap_slots]")
+{
+    // The boot slots and the CPU-local slots of the BSP with their own
+    // window ranges (see Hpt::remap).
+    constexpr uint64 BOOT_BASE {0x1000000}, CPU_BASE {0x2000000};
+
+    Remap_slots boot, local;
+    std::map<uint64, uint64> mapped;
+    bool fresh {false};
+
+    auto const remap {[&mapped, &fresh] (Remap_slots &slots, uint64 base, uint64 phys) {
+        unsigned const slot {slots.acquire (phys, fresh)};
+        REQUIRE(slot != Remap_slots::NUM_SLOTS);
+
+        uint64 const window {Remap_slots::window (base, slot, WINDOW)};
+
+        if (fresh) {
+            mapped[window] = phys;
+        }
+
+        CHECK(mapped[window] == phys);
+        slots.release (slot);
+    }};
+
+    for (uint64 i {0}; i < 2 * Remap_slots::NUM_SLOTS; i++) {
+        remap (boot, BOOT_BASE, i * WINDOW);
+    }
+
+    // Once CPU-local memory is set up, the early mappings are never used
+    // again and must not be clobbered by the later ones.
+    for (uint64 i {0}; i < 2 * Remap_slots::NUM_SLOTS; i++) {
+        remap (local, CPU_BASE, (i % 3) * WINDOW);
+        remap (local, CPU_BASE, (Remap_slots::NUM_SLOTS + i) * WINDOW);
+    }
+
+    for (unsigned slot {0}; slot < Remap_slots::NUM_SLOTS; slot++) {
+        CHECK(mapped[Remap_slots::window (BOOT_BASE, slot, WINDOW)] >= Remap_slots::NUM_SLOTS * WINDOW);
+        CHECK(Remap_slots::window (CPU_BASE, slot, WINDOW) >= BOOT_BASE + Remap_slots::NUM_SLOTS * WINDOW);
+    }
+}
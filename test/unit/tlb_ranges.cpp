@@ -0,0 +1,90 @@
+/*
+ * TLB range tests
+ *
+ * Copyright (C) 2020 Cyberus Technology GmbH.
+ *
+ * This file is part of the NOVA microhypervisor.
+ *
+ * NOVA is free software: you can redistribute it and/or modify it
+ * under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ *
+ * NOVA is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE. See the
+ * GNU General Public License version 2 for more details.
+ */
+
+#include <tlb_ranges.hpp>
+
+#include <catch2/catch.hpp>
+
+#include <vector>
+
+static std::vector<mword> pages_of (Tlb_ranges const &ranges)
+{
+    std::vector<mword> pages;
+
+    ranges.for_each_page ([&pages] (mword vaddr) { pages.push_back (vaddr); });
+    return pages;
+}
+
+TEST_CASE ("TLB ranges are empty initially", "[tlb_ranges]")
+{
+    Tlb_ranges ranges;
+
+    CHECK(ranges.empty());
+    CHECK_FALSE(ranges.full());
+    CHECK(pages_of (ranges).empty());
+}
+
+TEST_CASE ("TLB ranges invalidate each page once", "[tlb_ranges]")
+{
+    Tlb_ranges ranges;
+
+    ranges.add (0x1000, 0x2000, 12);
+    ranges.add (0x3000, 0x1000, 12);
+
+    CHECK_FALSE(ranges.empty());
+    CHECK(pages_of (ranges) == std::vector<mword> {0x1000, 0x2000, 0x3000});
+
+    // Superpages need a single invalidation.
+    ranges.add (0x40000000, 0x400000, 21);
+
+    CHECK(ranges.pages() == 5);
+    CHECK(pages_of (ranges) == std::vector<mword> {0x1000, 0x2000, 0x3000, 0x40000000, 0x40200000});
+
+    ranges.clear();
+    CHECK(ranges.empty());
+}
+
+TEST_CASE ("TLB ranges degrade to a full flush", "[tlb_ranges]")
+{
+    Tlb_ranges ranges;
+
+    SECTION("Too many pages") {
+        ranges.add (0, Tlb_ranges::MAX_PAGES << 12, 12);
+        CHECK_FALSE(ranges.full());
+
+        ranges.add (0x100000, 0x1000, 12);
+        CHECK(ranges.full());
+    }
+
+    SECTION("Too many ranges") {
+        for (mword i {0}; not ranges.full(); i++) {
+            REQUIRE(i < Tlb_ranges::MAX_PAGES);
+            ranges.add (i * 0x10000, 0x1000, 12);
+        }
+    }
+
+    SECTION("Merging a full set") {
+        Tlb_ranges all;
+        all.add_all();
+
+        ranges.add (0x1000, 0x1000, 12);
+        ranges.add (all);
+        CHECK(ranges.full());
+    }
+
+    CHECK_FALSE(ranges.empty());
+}